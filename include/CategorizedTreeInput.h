@@ -1,6 +1,7 @@
 #pragma once
 #include "TreeInput.h"
 #include <string>
+#include <vector>
 
 namespace YAML { class Node; }
 
@@ -13,8 +14,20 @@ public:
 
   // Step forward.
   virtual bool on_new_file(const char *) override;
+  virtual bool want_file(size_t, const char *) const override;
   virtual void on_open_file() override;
   virtual void on_close_file() override;
+  virtual void merge(const TreeInput &) override;
+  virtual void hash_inputs(Hasher &) const override;
+
+  // Assign every file added so far to its sample before looping.
+  // Unmatched files are reported and skipped. Returns the number of matched files.
+  // Files are then matched by index; get_file_icategory() and get_file_isample()
+  // return -1 for unmatched files, and get_sample_files() groups files by sample.
+  size_t plan();
+  size_t get_file_icategory(size_t) const;
+  size_t get_file_isample(size_t) const;
+  std::vector<size_t> get_sample_files(size_t, size_t) const;
 
   // Configuration.
   size_t get_ncategory() const;
@@ -25,6 +38,19 @@ public:
   std::string get_sample(size_t, size_t) const;
   bool get_sample_configuration(size_t, size_t, YAML::Node *, YAML::Node *category_configuration = nullptr) const;
   bool get_sample_configuration(const std::string &, YAML::Node *, YAML::Node *category_configuration = nullptr) const;
+  // Print categories and their samples on cout, e.g. once from a master chain.
+  void list_samples() const;
+
+  // Constants resolved once from the configuration.
+  // Categories are signal if configured with "is_signal: true" or set so.
+  // Samples provide "xs", "nevent" and numeric fields registered with
+  // add_sample_field(); missing or non-numeric values read as NAN.
+  bool get_category_issignal(size_t) const;
+  void set_category_issignal(size_t, bool);
+  double get_sample_xs(size_t, size_t) const;
+  double get_sample_nevent_total(size_t, size_t) const;
+  size_t add_sample_field(const char *);
+  double get_sample_field(size_t, size_t, size_t ifield) const;
 
   // Current position.
   std::string get_category() const;
@@ -33,6 +59,10 @@ public:
   size_t get_isample() const;
   bool get_category_configuration(YAML::Node *) const;
   bool get_sample_configuration(YAML::Node *) const;
+  bool get_category_issignal() const;
+  double get_sample_xs() const;
+  double get_sample_nevent_total() const;
+  double get_sample_field(size_t ifield) const;
 
   // Number of events per category/sample.
   // May NOT be up-to-date before closing a file.
@@ -40,6 +70,8 @@ public:
   size_t get_sample_nevent(const std::string &) const;
   size_t get_category_nevent(size_t) const;
   size_t get_sample_nevent(size_t, size_t) const;
+  // Credit events read elsewhere, e.g. by an earlier run.
+  void add_sample_nevent(size_t, size_t, size_t);
 
 protected:
   char *yamlpath_;
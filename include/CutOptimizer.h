@@ -0,0 +1,53 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+class HistOutput;
+class CutScan;
+
+// Grid search of cuts maximizing signal significance over binned yields.
+// Working points are lower cuts on x and y and a window [zlow, zhigh) in z,
+// all at bin edges. A 1D output has only the x cut, over its in-range bins
+// as drawn, and a 3D scan has all.
+class CutOptimizer {
+public:
+  enum Metric {
+    ASIMOV,              // sqrt(2((s + b)ln(1 + s/b) - s))
+    ASIMOV_UNCERTAINTY,  // Asimov with background uncertainty, see set_uncertainty()
+    S_OVER_SQRT_B,       // s/sqrt(b)
+  };
+
+  struct Point {
+    double significance;
+    double xcut, ycut, zlow, zhigh;
+    double s, b, b_error;
+  };
+
+  // Signal curves default to those flagged signal.
+  CutOptimizer(const HistOutput &);
+  CutOptimizer(const CutScan &);
+  ~CutOptimizer();
+  size_t get_ndim() const;
+
+  void set_signal(size_t icurve, bool sg);
+  void set_scale(double scale);  // applied to all yields
+  void set_metric(Metric metric) { metric_ = metric; }
+  Metric get_metric() const { return metric_; }
+  // Background uncertainty is its statistical one plus rel_syst times itself.
+  void set_uncertainty(double rel_syst) { rel_syst_ = rel_syst; }
+  // Working points with less background are skipped.
+  void set_min_background(double b) { min_background_ = b; }
+  void set_nthread(size_t nthread) { nthread_ = nthread; }  // 0 uses all cores
+
+  // Best topk working points by decreasing significance.
+  std::vector<Point> optimize(size_t topk) const;
+  double get_significance(double s, double b, double b_error) const;
+  void print(const std::vector<Point> &) const;
+
+protected:
+  Metric metric_;
+  double rel_syst_;
+  double min_background_;
+  size_t nthread_;
+  class Detail; Detail *detail_;
+};
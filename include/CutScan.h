@@ -0,0 +1,52 @@
+#pragma once
+#include "EventViewer.h"
+#include <stddef.h>
+#include <vector>
+
+class TH3;
+
+// Use cumulative 3D histograms saved to filename as IEvent destination.
+// Curves are filled with (x, y, z) per event, and yields passing any pair of
+// lower cuts on x and y are read out afterwards as a distribution in z.
+// Cuts are rounded down to bin edges of x and y.
+class CutScan : virtual public EventViewer {
+public:
+  CutScan(const char *filename, size_t nx, double xlb, double xub,
+      size_t ny, double ylb, double yub, size_t nz, double zlb, double zub);
+  ~CutScan();
+  const char *get_filename() const { return filename_; }
+  void set_filename(const char *);  // nullptr disables save()
+
+  // Curves in the same scan.
+  size_t add_curve(const char *title, bool sg = false);
+  size_t get_ncurve() const;
+  TH3 *get_curve(size_t) const;
+  const char *get_curve_title(size_t) const;
+  bool curve_issignal(size_t) const;
+  bool fill_curve(size_t, double x, double y, double z, double weight = 1.0) const;
+  virtual bool process() override = 0;
+
+  // Binning of scanned variables: 0 for x, 1 for y and 2 for z.
+  size_t get_nbin(int axis) const;
+  double get_bin_edge(int axis, size_t ibin) const;  // low edge of bin ibin, 0 to nbin + 1
+  size_t find_bin(int axis, double value) const;
+
+  // Read out curve i with x >= xcut and y >= ycut, per z bin 0 to nz + 1.
+  // The sum of squared weights goes to sumw2 if not nullptr.
+  std::vector<double> project_z(size_t i, double xcut, double ycut, std::vector<double> *sumw2 = nullptr) const;
+  // Same for z in [zlow, zhigh), including whole bins.
+  double get_yield(size_t i, double xcut, double ycut, double zlow, double zhigh, double *sumw2 = nullptr) const;
+  // Read out curve i with x >= xcut, per y bin 0 to ny + 1.
+  std::vector<double> project_y(size_t i, double xcut, std::vector<double> *sumw2 = nullptr) const;
+
+  // Add curves of another scan with the same curves and binning.
+  bool merge(const CutScan &);
+
+  // Save and load curves.
+  bool save() const;
+  bool load(const char *);
+
+protected:
+  char *filename_;
+  class Detail; Detail *detail_;
+};
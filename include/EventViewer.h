@@ -1,4 +1,5 @@
 #pragma once
+#include <stddef.h>
 
 class EventViewer;
 
@@ -21,5 +22,38 @@ public:
   virtual void proceed() { }
 
   // Process current and subsequent events.
-  virtual void loop() { while(next()) if(process()) proceed(); }
+  // With profiling, a summary of the chain is printed at the end.
+  virtual void loop();
+
+  // Optional instrumentation, off by default, to be switched before looping.
+  // The counted_*() wrappers call next(), process() and proceed(), counting
+  // calls, successful ones and seconds spent when profiling is on. Time of
+  // proceed() includes subsequent viewers. Drivers of the chain call them
+  // instead of the plain methods.
+  struct Counters { size_t ncall, npass; double seconds; };
+  enum CounterKind { NEXT, PROCESS, PROCEED, NCOUNTER };
+  static void set_profiling(bool);
+  static bool get_profiling() { return profiling_; }
+  bool counted_next()
+    { if(!profiling_) return next(); double start = now(); return tally(NEXT, next(), start); }
+  bool counted_process()
+    { if(!profiling_) return process(); double start = now(); return tally(PROCESS, process(), start); }
+  void counted_proceed()
+    { if(!profiling_) return proceed(); double start = now(); proceed(); tally(PROCEED, true, start); }
+  const Counters &get_counters(CounterKind kind) const { return counters_[kind]; }
+  void merge_counters(const EventViewer &);
+
+  // Print counters and the cutflow of the tree of viewers headed by *this.
+  // loop() does it unless disabled, as for chains merged afterwards.
+  void print_profile() const;
+  void set_profile_summary(bool enable) { profile_summary_ = enable; }
+
+private:
+  static bool profiling_;
+  Counters counters_[NCOUNTER] = { };
+  bool profile_summary_ = true;
+
+  void print_profile_tree(size_t depth) const;
+  static double now();
+  bool tally(CounterKind, bool pass, double start);
 };
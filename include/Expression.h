@@ -0,0 +1,46 @@
+#pragma once
+#include <stddef.h>
+
+// Arithmetic and logical expressions over named columns, parsed once and
+// compiled into bytecode whose instructions each run one tight loop over a
+// batch of events, with constant subexpressions folded at compile time.
+//
+// Syntax, by increasing precedence:
+//   c ? a : b    a || b    a && b    == !=    < <= > >=    + -    * /
+//   unary - !    a ^ b (right-associative)
+// Operands are numbers, parenthesized expressions, function calls
+// (abs sqrt exp log sin cos tanh min max pow) and symbols, which are
+// identifiers of letters, digits, '_' and '.', optionally followed by a
+// constant element index like "Jet_pt[0]". Logical results are 1 or 0.
+class Expression {
+public:
+  Expression(const char *source);  // throws std::logic_error on syntax errors
+  Expression(const Expression &);
+  Expression &operator=(const Expression &);
+  ~Expression();
+  const char *get_source() const;
+
+  // Symbols in order of first appearance, to be bound to columns by eval().
+  size_t get_nsymbol() const;
+  const char *get_symbol(size_t) const;
+  size_t find_symbol(const char *) const;  // -1 if absent
+
+  // Replace a symbol by another expression or a constant.
+  // Returns false if the symbol is absent.
+  bool substitute(const char *name, const Expression &);
+  bool substitute(const char *name, double value);
+  bool is_constant(double *value = nullptr) const;
+
+  // Evaluate n events into out, column i holding n values of symbol i.
+  // Scratch space is reused between calls, so one expression must not be
+  // evaluated by several threads at a time.
+  void eval(const double *const *columns, size_t n, double *out) const;
+
+  // Convert element index of each of n events in a batch column of the given
+  // ROOT type code (see TreeInput::get_branch_type()) to double.
+  // Events with fewer elements get NAN. Returns false on unknown types.
+  static bool gather(char type, const void *data, const size_t *offsets, size_t index, size_t n, double *out);
+
+protected:
+  class Detail; Detail *detail_;
+};
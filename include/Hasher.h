@@ -0,0 +1,26 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Incremental 64-bit FNV-1a hash for cache keys.
+class Hasher {
+public:
+  Hasher();
+
+  // Feed data. Strings are length-prefixed so that concatenations differ.
+  Hasher &update(const void *, size_t);
+  Hasher &update(const std::string &);
+  Hasher &update(const char *s) { return update(std::string(s)); }
+  Hasher &update(uint64_t);
+  Hasher &update(double);
+
+  // Feed file content. Returns false if the file is unreadable.
+  bool update_file(const char *);
+
+  uint64_t digest() const { return state_; }
+  std::string hexdigest() const;
+
+private:
+  uint64_t state_;
+};
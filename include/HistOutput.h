@@ -12,6 +12,7 @@ public:
   const char *get_xtitle() const { return xtitle_; }
   const char *get_ytitle() const { return ytitle_; }
   const char *get_filename() const { return filename_; }
+  void set_filename(const char *);  // nullptr disables save()
 
   // Curves in the same plot.
   size_t add_curve(const char *title, bool sg = false);
@@ -20,6 +21,10 @@ public:
   const char *get_curve_title(size_t) const;
   bool curve_issignal(size_t) const;
   bool fill_curve(size_t, double value, double weight = 1.0) const;
+  // Fill n values at once, all weighing 1.0 if weights is nullptr.
+  // Returns the number of values filled, skipping non-finite ones.
+  size_t fill_curve_batch(size_t, const double *values, const double *weights, size_t n) const;
+  size_t fill_curve_batch(size_t, const float *values, const double *weights, size_t n) const;
   virtual bool process() override = 0;
 
   // Boundary and binning control.
@@ -30,6 +35,19 @@ public:
   bool is_binned() const;
   void bin();
 
+  // Bounded-memory auto-range mode, to be set before filling.
+  // Unbinned values are summarized in nfine bins instead of being kept: linear
+  // around the bulk of the first values, geometric beyond, so that outliers do
+  // not coarsen the bulk. Binning is decided by bin() or save(). Without an
+  // explicit boundary, the [qlow, qhigh] quantile range is used. nfine is
+  // rounded up to an even number, at least 4.
+  // Outputs sharing a sketch take the bins of whichever first leaves
+  // buffering, so that their sketches merge bin by bin rather than by bin
+  // middles. Shared bins are kept by reset().
+  void set_sketch(size_t nfine, double qlow = 0.0, double qhigh = 1.0);
+  bool is_sketched() const;
+  void share_sketch(const HistOutput &);
+
   // Legend control.
   void get_legend_pos(double &xl, double &xh, double &yl, double &yh)
     { xl = legend_pos_.xl, xh = legend_pos_.xh, yl = legend_pos_.yl, yh = legend_pos_.yh; }
@@ -42,12 +60,33 @@ public:
   void set_logy(bool enable) { logy_ = enable; }
   bool get_logy() { return logy_; }
   void set_rangex(double min, double max) { rangex_ = true; xmin_ = min, xmax_ = max; }
-  void set_rangey(double min, double max) { rangey_ = true; ymin_ = min, ymax_ = max; }
+  void set_rangey(double min, double max) { rangey_ = true, rangey_fit_ = false; ymin_ = min, ymax_ = max; }
+  // Fit the y-range to [min, 1.2 * highest bin] when saving, after any merge.
+  void set_rangey_fit(double min) { rangey_ = rangey_fit_ = true; ymin_ = min; }
   void set_gridx(bool enable) { gridx_ = enable; }
   bool get_gridx() { return gridx_; }
   void set_gridy(bool enable) { gridy_ = enable; }
   bool get_gridy() { return gridy_; }
 
+  // Events per curve, read and in total, and their cross section in pb.
+  // Kept in caches and summed by merge(), and shown in legends as
+  // "(read/total events scaled to xs pb)".
+  void set_curve_nevent(size_t, double nevent, double nevent_total, double xs);
+
+  // Persistent cache of curves, titles, signal flags, event counts and axis settings.
+  // save() also writes the cache file if set. A loaded output replaces its
+  // state with the cached one and needs no filling.
+  void set_cache_filename(const char *);  // nullptr disables caching
+  const char *get_cache_filename() const;
+  bool save_cache(const char *) const;
+  bool load_cache(const char *);
+  bool is_loaded() const;
+
+  // Add curves of another output with the same curves and binning.
+  bool merge(const HistOutput &);
+  // Empty curves, keeping curves, binning and settings.
+  void reset();
+
   // Draw and save histograms.
   bool save() const;
 
@@ -56,7 +95,7 @@ protected:
   char *ytitle_;
   char *filename_;
   struct { double xl, xh, yl, yh; } legend_pos_;
-  bool logx_, logy_, rangex_, rangey_, gridx_, gridy_;
+  bool logx_, logy_, rangex_, rangey_, rangey_fit_, gridx_, gridy_;
   double xmin_, xmax_, ymin_, ymax_;
   class Detail; Detail *detail_;
 };
@@ -0,0 +1,42 @@
+#pragma once
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class HistOutput;
+
+// Record of input files processed by earlier runs, kept in a directory as
+// ledger.yaml, indexing path, size, mtime and events read, plus the partial
+// histograms of each file in the cache format of HistOutput.
+// Methods may be called from several threads at a time.
+class Ledger {
+public:
+  Ledger(const char *dirpath);  // created with parents if missing; loads any existing index
+  ~Ledger();
+  const char *get_dirpath() const { return dirpath_; }
+
+  // Whether path is recorded with its current size and mtime.
+  bool is_current(const char *path) const;
+  size_t get_nevent(const char *path) const;  // 0 if not recorded
+  size_t get_nrecord() const;
+
+  // Drop records of files not among paths or changed since, with their partials.
+  // Returns the number of records dropped.
+  size_t prune(const std::vector<std::string> &paths);
+
+  // Save outputs as the partials of path, read with nevent events, and reset them.
+  // On failure, outputs are left as they are, so that their data stay in the
+  // in-memory result. The index is written by save(), not on every record.
+  bool record(const char *path, size_t nevent, const std::vector<HistOutput *> &);
+
+  // Add partials of all records to outputs, matched by position.
+  bool sum(const std::vector<HistOutput *> &) const;
+
+  // Write the index if records changed since it was last written, which
+  // prune() and the destructor also do.
+  bool save() const;
+
+protected:
+  char *dirpath_;
+  class Detail; Detail *detail_;
+};
@@ -1,20 +1,53 @@
 #pragma once
 #include "EventViewer.h"
+#include <vector>
 
 // Event viewers that can have subsequent procedures.
+// Viewers may have several children, making a tree: each child sees every
+// event passed by its parent, whatever its siblings decide, so consumers of
+// the same events share one read without inheriting each other's cuts.
 class MultiStep : virtual public EventViewer {
 public:
   MultiStep(EventViewer *then = nullptr) : then_(then) { }
-  ~MultiStep() { delete then_; }
+  ~MultiStep() { delete then_; for(EventViewer *viewer : more_then_) delete viewer; }
 
-  // Pass down data and control flow.
-  void proceed() override { if(then_ && then_->process()) then_->proceed(); }
+  // Pass down data and control flow, to children in order.
+  void proceed() override {
+    if(then_ && then_->counted_process()) then_->counted_proceed();
+    for(EventViewer *viewer : more_then_) if(viewer->counted_process()) viewer->counted_proceed();
+  }
 
-  // Modify descendants.
+  // Access and modify descendants.
+  // then() and set_then() replace the first child; add_then() appends one.
+  EventViewer *get_then() const { return then_; }
   virtual void set_then(EventViewer *then) { delete then_; then_ = then; }
   EventViewer *then(EventViewer *viewer) { set_then(viewer); return viewer; }
   MultiStep *then(MultiStep *viewer) { set_then(viewer); return viewer; }
+  EventViewer *add_then(EventViewer *viewer) { add_child(viewer); return viewer; }
+  MultiStep *add_then(MultiStep *viewer) { add_child(viewer); return viewer; }
+  size_t get_nthen() const { return more_then_.empty() ? then_ != nullptr : 1 + more_then_.size(); }
+  EventViewer *get_then(size_t i) const { return i == 0 ? then_ : i <= more_then_.size() ? more_then_[i - 1] : nullptr; }
+
+  // Viewers of the tree headed by viewer, parents before children.
+  static std::vector<EventViewer *> get_tree(EventViewer *viewer) {
+    std::vector<EventViewer *> tree;
+    if(viewer) walk(viewer, tree);
+    return tree;
+  }
 
 protected:
   EventViewer *then_;  // owned by *this
+  std::vector<EventViewer *> more_then_;  // owned by *this
+
+private:
+  void add_child(EventViewer *viewer) { if(then_) more_then_.push_back(viewer); else then_ = viewer; }
+
+  static void walk(EventViewer *viewer, std::vector<EventViewer *> &tree) {
+    tree.push_back(viewer);
+    MultiStep *step = dynamic_cast<MultiStep *>(viewer);
+    for(size_t i = 0; step && i < step->get_nthen(); ++i) {
+      EventViewer *child = step->get_then(i);
+      if(child) walk(child, tree);
+    }
+  }
 };
@@ -0,0 +1,33 @@
+#pragma once
+#include <stddef.h>
+#include <functional>
+
+class TreeInput;
+
+// Run copies of a viewer chain headed by a TreeInput over its files in parallel.
+class ParallelLoop {
+public:
+  // The factory builds a chain identical to the master one.
+  // nthread = 0 uses all available cores.
+  ParallelLoop(TreeInput *master, std::function<TreeInput *()> factory, size_t nthread = 0);
+  size_t get_nthread() const { return nthread_; }
+
+  // Split files into cluster-aligned entry ranges (default), so that a large
+  // file is shared by chains, or hand out whole files. Chains needing whole
+  // files, e.g. to record per-file results, should disable it.
+  void set_split_files(bool enable) { split_files_ = enable; }
+  bool get_split_files() const { return split_files_; }
+
+  // Process files of the master with nthread chains, the master included.
+  // Split files are scanned first unless the master is already scanned. Tasks
+  // are dealt largest first to per-chain queues; a chain out of tasks steals
+  // the smallest one left of another chain.
+  // Worker chains are merged into the master one and destroyed on return.
+  void loop();
+
+protected:
+  TreeInput *master_;
+  std::function<TreeInput *()> factory_;
+  size_t nthread_;
+  bool split_files_;
+};
@@ -0,0 +1,108 @@
+#pragma once
+#include "EventViewer.h"
+#include "MultiStep.h"
+#include <tuple>
+#include <utility>
+#include <typeinfo>
+
+// Run a chain of known stage types without virtual dispatch.
+// run_pipeline<Head, Stages...>(head) checks once that the chain headed by
+// head is made of exactly these types, in order, and then loops calling
+// next() and process() qualified by the static types, so that the compiler
+// can inline the whole chain into one loop. An event reaches a stage only if
+// all stages before it passed, as with MultiStep::proceed().
+// run_fanout<Head, Children...>(head) does the same for a head whose
+// children are exactly Children, in order, none having children of its own;
+// every child processes each event passed by the head.
+// Both return false without looping if the viewers do not match or profiling
+// is on, so that callers can fall back to the runtime tree.
+template<class Head, class... Stages>
+bool run_pipeline(Head *head);
+template<class Head, class... Children>
+bool run_fanout(Head *head);
+
+namespace pipeline_detail {
+
+inline size_t get_nthen(EventViewer *viewer)
+{
+  MultiStep *step = dynamic_cast<MultiStep *>(viewer);
+  return step ? step->get_nthen() : 0;
+}
+
+// Bind stage to the only child of viewer, moving viewer to it.
+template<class Stage>
+bool bind(EventViewer *&viewer, Stage *&stage)
+{
+  if(get_nthen(viewer) != 1) return false;
+  viewer = dynamic_cast<MultiStep *>(viewer)->get_then();
+  stage = dynamic_cast<Stage *>(viewer);
+  return stage && typeid(*viewer) == typeid(Stage);
+}
+
+// Bind child to child i of parent, which must have no children.
+template<class Child>
+bool bind_child(EventViewer *parent, size_t i, Child *&child)
+{
+  EventViewer *viewer = dynamic_cast<MultiStep *>(parent)->get_then(i);
+  child = dynamic_cast<Child *>(viewer);
+  return child && typeid(*viewer) == typeid(Child) && get_nthen(viewer) == 0;
+}
+
+template<class Stage>
+bool process(Stage *stage)
+{
+  return stage->Stage::process();
+}
+
+template<class... Stages, size_t... I>
+bool bind_all(EventViewer *viewer, std::tuple<Stages *...> &stages, std::index_sequence<I...>)
+{
+  bool ok = true;
+  ((ok = ok && bind(viewer, std::get<I>(stages))), ...);
+  return ok && get_nthen(viewer) == 0;  // Nothing left unrun.
+}
+
+template<class... Children, size_t... I>
+bool bind_children(EventViewer *parent, std::tuple<Children *...> &children, std::index_sequence<I...>)
+{
+  if(get_nthen(parent) != sizeof...(Children)) return false;
+  bool ok = true;
+  ((ok = ok && bind_child(parent, I, std::get<I>(children))), ...);
+  return ok;
+}
+
+template<class... Stages, size_t... I>
+void process_all(const std::tuple<Stages *...> &stages, std::index_sequence<I...>)
+{
+  (void)(process(std::get<I>(stages)) && ...);
+}
+
+template<class... Children, size_t... I>
+void process_each(const std::tuple<Children *...> &children, std::index_sequence<I...>)
+{
+  (process(std::get<I>(children)), ...);
+}
+
+}  // namespace pipeline_detail
+
+template<class Head, class... Stages>
+bool run_pipeline(Head *head)
+{
+  if(EventViewer::get_profiling() || typeid(*head) != typeid(Head)) return false;
+  std::tuple<Stages *...> stages;
+  auto indices = std::index_sequence_for<Stages...>();
+  if(!pipeline_detail::bind_all(head, stages, indices)) return false;
+  while(head->Head::next()) if(head->Head::process()) pipeline_detail::process_all(stages, indices);
+  return true;
+}
+
+template<class Head, class... Children>
+bool run_fanout(Head *head)
+{
+  if(EventViewer::get_profiling() || typeid(*head) != typeid(Head)) return false;
+  std::tuple<Children *...> children;
+  auto indices = std::index_sequence_for<Children...>();
+  if(!pipeline_detail::bind_children(head, children, indices)) return false;
+  while(head->Head::next()) if(head->Head::process()) pipeline_detail::process_each(children, indices);
+  return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "EventViewer.h"
+#include <stddef.h>
+
+class TreeInput;
+
+// Use flat columnar skim files as IEvent destination.
+// Requested branches of the input are written uncompressed, one skim file per
+// input file, named after it with SUFFIX appended. TreeInput reads skim files
+// added by add_filename() through mmap(), with the same branch interface;
+// branch data then point into the mapping instead of being copied.
+// Skim files are named after their input, so categorized inputs match them
+// to samples by name as they would the input.
+// Only branches of fundamental types can be skimmed.
+//
+// Layout, all integers being native uint64_t:
+//   MAGIC, nbranch, nevent,
+//   per branch: name length, name, type code (see TreeInput::get_branch_type()),
+//   elem_size, nelem_max, column position;
+//   per column at its 64-byte aligned position: nevent + 1 offsets counted
+//   in elements, then the elements of all events.
+class SkimOutput : virtual public EventViewer {
+public:
+  SkimOutput(TreeInput *input, const char *dirpath);
+  ~SkimOutput();
+  const char *get_dirpath() const { return dirpath_; }
+
+  static const char MAGIC[8];
+  static const char SUFFIX[];
+
+  // Collect current event of the input.
+  // The skim file of an input file is written once the input moves on.
+  virtual bool process() override;
+
+  // Write the skim file being collected, if any.
+  bool flush();
+
+protected:
+  TreeInput *input_;
+  char *dirpath_;
+  class Detail; Detail *detail_;
+};
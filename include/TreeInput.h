@@ -1,6 +1,11 @@
 #pragma once
 #include "EventViewer.h"
 #include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+class Hasher;
 
 // Use TTree from multiple TFiles as IEvent source.
 class TreeInput : virtual public EventViewer {
@@ -12,6 +17,9 @@ public:
   // Step forward.
   virtual bool next() override;
   virtual bool on_new_file(const char *) { return true; }
+  // Cheap check without side effects when a file is claimed, before it is
+  // opened or prefetched. Files failing it are skipped without on_new_file().
+  virtual bool want_file(size_t, const char *) const { return true; }
   virtual void on_open_file() { }
   virtual void on_close_file() { }
 
@@ -27,22 +35,201 @@ public:
   size_t add_filename(const char *);
   size_t get_nfilename() const;
   const char *get_filename(size_t) const;
+  // Keep only files of shard ishard out of nshard, balanced by file size.
+  // Files are taken largest first, ties broken by name, each by the least
+  // loaded shard, so every shard computes the same split independently.
+  // Returns the number of files kept.
+  size_t select_shard(size_t ishard, size_t nshard);
+
+  // Pre-scan of file sources on nthread threads, 0 using all cores.
+  // Entries and compressed bytes of requested branches (of the whole tree if
+  // none) are kept per file, 0 for unreadable files. Returns the total entries.
+  size_t scan_files(size_t nthread = 0);
+  bool is_scanned() const;
+  size_t get_file_nentry(size_t) const;
+  size_t get_file_zip_bytes(size_t) const;
+  // Entries starting clusters of a file, followed by its number of entries.
+  std::vector<size_t> get_file_clusters(size_t) const;
+
+  // Pre-flight planning of file sources: scan_files() checking requested
+  // branches as well, so that broken files, missing branches and unsupported
+  // leaves are all reported before the loop rather than when reached. Files
+  // with problems are then passed over, and branch buffers are allocated
+  // once at their largest over the other files. With a cache path, a plan
+  // there is reused if files, branches and typed handles are unchanged, else
+  // saved there. Returns the number of files with problems.
+  // share_plan() adopts the plan of an input with the same files.
+  size_t plan_files(size_t nthread = 0, const char *cache_path = nullptr);
+  void share_plan(const TreeInput &);
+  bool is_planned() const;
+  const char *get_file_problem(size_t) const;  // nullptr if none
+
+  // Report events done/total, events/s, MB/s, files left and ETA on clog at
+  // most every interval seconds, 0 disabling. Totals are known after
+  // scan_files(), and exclude entries of files skipped or failing to open,
+  // which count as started. Reports are considered every 4096 events, so the clock is
+  // not read per event. Inputs sharing progress report jointly.
+  void set_progress_interval(double seconds);
+  void share_progress(const TreeInput &);
 
   // Select branches to read.
-  // add_branch() should be called before any call to next().
+  // add_branch() should be called before any call to next(). A branch added
+  // again keeps its index, so that its data are read once and shared.
   // The behavior is undefined if requested branches change while sliding.
-  size_t add_branch(const char *);
+  // Lazy branches are read on first get_branch_data() of each event instead of
+  // in next(), and are kept out of the read cache, so that baskets of events
+  // never looked at are neither fetched nor decompressed.
+  size_t add_branch(const char *, bool lazy = false);
   size_t get_nbranch() const;
   const char *get_branch(size_t) const;
+  bool is_branch_lazy(size_t) const;
+
+  // Feed what determines the events read into a cache key: tree name,
+  // file names with sizes and modification times, and requested branches.
+  virtual void hash_inputs(Hasher &) const;
+
+  // Read events in columnar batches.
+  // next_batch() steps forward by up to n events of one file and returns the
+  // number of events read, 0 at the end. Batches never cross files, so per-file
+  // state stays valid for the whole batch. Data of each branch is contiguous:
+  // event k owns elements [offsets[k], offsets[k + 1]) of get_batch_data().
+  // The current event is the last one of the batch.
+  size_t next_batch(size_t n);
+  size_t get_batch_size() const;
+  void *get_batch_data(size_t, const size_t **offsets = nullptr) const;
+
+  // Read cache of baskets of the requested branches.
+  // Size 0 (default) fits one cluster of the requested branches.
+  // Branches read but not requested are picked up in the first
+  // learn_entries entries of each file (0 disables learning).
+  void set_cache_enabled(bool enable);
+  bool get_cache_enabled() const;
+  void set_cache_size(size_t);
+  size_t get_cache_size() const;
+  void set_cache_learn_entries(size_t);
+  size_t get_cache_learn_entries() const;
+
+  // I/O counters accumulated over opened files, the current one included.
+  // Reads going through the cache count as hits; those bypassing it as misses.
+  struct IOStats {
+    size_t bytes_read, read_calls;
+    size_t cache_hit_bytes, cache_hit_calls;
+    size_t cache_miss_bytes, cache_miss_calls;
+  };
+  IOStats get_io_stats() const;
+
+  // Open up to nfile upcoming files on helper threads while reading the
+  // current one. 0 (default) opens files only when switching to them.
+  void set_prefetch(size_t nfile);
+  size_t get_prefetch() const;
+
+  // Entries [begin, end) of each file are read, clipped to its entries.
+  // Within a file, get_local_index() is the entry index, and in on_close_file()
+  // get_local_index() - get_entry_begin() is the number of entries read.
+  void set_entry_range(size_t begin, size_t end);
+  size_t get_entry_begin() const;
+  size_t get_entry_end() const;
+
+  // Parallel reading.
+  // The dispatcher returns the index of the next file to read, or any index
+  // not less than get_nfilename() when no file is left. It replaces the
+  // default in-order walk and may be shared by inputs running in parallel.
+  // A task dispatcher hands out entry ranges of files instead, overriding
+  // set_entry_range(); a file is then opened once per task.
+  void set_dispatcher(std::function<size_t()>);
+  struct Task { size_t ifilename, begin, end; };
+  void set_task_dispatcher(std::function<Task()>);
+  // Merge bookkeeping of another input which has read disjoint files.
+  virtual void merge(const TreeInput &);
 
   // Get branch data and metadata.
   // get_branch_elem_size() returns size of pointers for class objects.
-  // get_branch_elem_size() and get_branch_nelem_max() return 0 on error.
-  void *get_branch_data(size_t, size_t *nelem = nullptr) const;
+  // get_branch_type() returns the ROOT leaf type code of elements
+  // (F D I i L l S s B b O), or 0 for class objects and leaves of mixed types.
+  // get_branch_elem_size(), get_branch_nelem_max() and get_branch_type() return 0 on error.
+  // get_branch_data() returns nullptr on error, including lazy reading errors.
+  // Data is read-only: for skim files it lies in a read-only file mapping.
+  const void *get_branch_data(size_t, size_t *nelem = nullptr) const;
   size_t get_branch_elem_size(size_t) const;
   size_t get_branch_nelem_max(size_t) const;
+  char get_branch_type(size_t) const;
+
+  // Get branch elements as a contiguous span.
+  // Beyond plain arrays, this covers std::vector branches of fundamental
+  // types, whose elements are found in the vector object read, and
+  // multi-leaf branches with leaves of one type, read as one array.
+  // get_branch_span_type() is the type code of elements, or 0 if the branch
+  // reads as opaque objects. get_branch_span<T>() is empty if T mismatches.
+  // Leaves of multi-leaf branches, including those of mixed types read as
+  // one struct, are described by get_branch_leaf*(), with byte offsets into
+  // get_branch_data(); a single-leaf branch has one, class objects none.
+  template<class T> struct Span {
+    const T *data;
+    size_t size;
+    const T *begin() const { return data; }
+    const T *end() const { return data + size; }
+    const T &operator[](size_t i) const { return data[i]; }
+    bool empty() const { return size == 0; }
+  };
+  const void *get_branch_span(size_t, size_t *nelem) const;
+  char get_branch_span_type(size_t) const;
+  template<class T> Span<T> get_branch_span(size_t i) const {
+    size_t nelem = 0;
+    const void *data = get_branch_span_type(i) == TypeCode<T>::value ? get_branch_span(i, &nelem) : nullptr;
+    return Span<T>{ (const T *)data, data ? nelem : 0 };
+  }
+  size_t get_branch_nleaf(size_t) const;
+  const char *get_branch_leaf(size_t, size_t) const;
+  char get_branch_leaf_type(size_t, size_t) const;
+  size_t get_branch_leaf_offset(size_t, size_t) const;
+
+  // Typed access to branches.
+  // add_branch<T>() requests a branch like add_branch() and returns a handle
+  // to its elements as T, one of float, double, bool and the fixed-width
+  // integers. The on-disk type is checked once per file when opened; files
+  // with a branch of non-numeric type are skipped. Elements of another
+  // numeric type are converted once per read, a whole array at a time, so
+  // that get() is a plain load for eager branches. get() returns nullptr
+  // before the first file is opened and on lazy reading errors.
+  template<class T> struct TypeCode;
+  template<class T> class Branch {
+  public:
+    Branch() : input_(nullptr), slot_(nullptr), iview_(0), lazy_(false) { }
+    const T *get() const { return lazy_ ? (const T *)input_->load_view(iview_) : (const T *)*slot_; }
+    const T &operator*() const { return *get(); }
+    size_t get_index() const { return input_->get_view_branch(iview_); }
+
+  private:
+    friend class TreeInput;
+    Branch(const TreeInput *input, size_t iview, bool lazy)
+      : input_(input), slot_(input->get_view_slot(iview)), iview_(iview), lazy_(lazy) { }
+    const TreeInput *input_;
+    void *const *slot_;
+    size_t iview_;
+    bool lazy_;
+  };
+  template<class T> Branch<T> add_branch(const char *name, bool lazy = false)
+    { return Branch<T>(this, add_view(name, lazy, TypeCode<T>::value, sizeof(T)), lazy); }
 
 protected:
   char *name_;
   class Detail; Detail *detail_;
+
+private:
+  size_t add_view(const char *name, bool lazy, char type, size_t elem_size);
+  void *const *get_view_slot(size_t) const;
+  size_t get_view_branch(size_t) const;
+  const void *load_view(size_t) const;
 };
+
+template<> struct TreeInput::TypeCode<float> { static const char value = 'F'; };
+template<> struct TreeInput::TypeCode<double> { static const char value = 'D'; };
+template<> struct TreeInput::TypeCode<int32_t> { static const char value = 'I'; };
+template<> struct TreeInput::TypeCode<uint32_t> { static const char value = 'i'; };
+template<> struct TreeInput::TypeCode<int64_t> { static const char value = 'L'; };
+template<> struct TreeInput::TypeCode<uint64_t> { static const char value = 'l'; };
+template<> struct TreeInput::TypeCode<int16_t> { static const char value = 'S'; };
+template<> struct TreeInput::TypeCode<uint16_t> { static const char value = 's'; };
+template<> struct TreeInput::TypeCode<int8_t> { static const char value = 'B'; };
+template<> struct TreeInput::TypeCode<uint8_t> { static const char value = 'b'; };
+template<> struct TreeInput::TypeCode<bool> { static const char value = 'O'; };
@@ -47,6 +47,7 @@ public:
   bool islnk() const;
 
   size_t size() const;
+  long long mtime() const;  // in nanoseconds since epoch
 
   explicit operator bool() const { return exists(); }
 
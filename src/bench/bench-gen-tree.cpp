@@ -0,0 +1,116 @@
+#include <TFile.h>
+#include <TTree.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <memory>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <math.h>
+
+using namespace std;
+
+// Branches read by hist-hss-score, filled with signal-like or background-like shapes.
+static const char *const SCORE_BRANCHES[] = {
+  "ak15_ParTMDV2_Hss", "ak15_ParTMDV2_QCDbb", "ak15_ParTMDV2_QCDb",
+  "ak15_ParTMDV2_QCDcc", "ak15_ParTMDV2_QCDc", "ak15_ParTMDV2_QCDothers",
+};
+
+int main(int argc, char *argv[])
+{
+  size_t nentry = 100000, nfile = 4, nextra = 0, narray = 0;
+  int compress = 101;
+  for(int opt; (opt = getopt(argc, argv, "n:f:b:c:a:")) != -1;) {
+    switch(opt) {
+      case 'n': nentry = stoul(optarg); break;
+      case 'f': nfile = stoul(optarg); break;
+      case 'b': nextra = stoul(optarg); break;
+      case 'c': compress = stoi(optarg); break;
+      case 'a': narray = stoul(optarg); break;
+      default: return 1;
+    }
+  }
+  argc -= optind - 1, argv += optind - 1;
+
+  if(argc != 2 || nfile == 0) {
+    cerr << "usage: " << program_invocation_short_name
+         << " [ -n <entries-per-file> ] [ -f <nfile> ] [ -b <extra-branches> ]"
+         << " [ -c <compression-setting> ] [ -a <max-array-length> ] <output-dir>" << endl;
+    return 1;
+  }
+
+  // Trees go to <output-dir>/trees, and the categorization to <output-dir>/bench.yaml.
+  string dirpath = argv[1], treedir = dirpath + "/trees";
+  for(const string &path : { dirpath, treedir }) {
+    if(mkdir(path.c_str(), 0755) && errno != EEXIST) {
+      cerr << "Error: failed to create directory " << path << ": " << strerror(errno) << endl;
+      return 1;
+    }
+  }
+
+  // Even files are signal, odd ones background.
+  size_t nevent_total[2] = { };
+  for(size_t ifile = 0; ifile < nfile; ++ifile) {
+    bool sg = ifile % 2 == 0;
+    string filename = treedir + "/bench-" + (sg ? "sg" : "bg") + "_" + to_string(ifile) + "_tree.root";
+    unique_ptr<TFile> file(new TFile(filename.c_str(), "RECREATE", "", compress));
+    if(!file->IsOpen()) {
+      cerr << "Error: failed to create file: " << filename << endl;
+      return 1;
+    }
+    TTree *tree = new TTree("Events", "Events");
+
+    float scores[6], kinBDT, mass;
+    vector<float> extra(nextra);
+    int nJet = 0;
+    vector<float> Jet_pt(max(narray, (size_t)1));
+    for(size_t i = 0; i < 6; ++i) tree->Branch(SCORE_BRANCHES[i], &scores[i], (string(SCORE_BRANCHES[i]) + "/F").c_str());
+    tree->Branch("kinBDT", &kinBDT, "kinBDT/F");
+    tree->Branch("ak15_regressed_mass", &mass, "ak15_regressed_mass/F");
+    for(size_t i = 0; i < nextra; ++i) {
+      string name = "extra_" + to_string(i);
+      tree->Branch(name.c_str(), &extra[i], (name + "/F").c_str());
+    }
+    if(narray) {
+      tree->Branch("nJet", &nJet, "nJet/I");
+      tree->Branch("Jet_pt", Jet_pt.data(), "Jet_pt[nJet]/F");
+    }
+
+    mt19937_64 rng(ifile);
+    uniform_real_distribution<float> uniform(0.0, 1.0);
+    normal_distribution<float> peak(125.0, 15.0);
+    exponential_distribution<float> falling(1.0 / 60.0);
+    uniform_int_distribution<int> njet(0, narray);
+    for(size_t ientry = 0; ientry < nentry; ++ientry) {
+      float u = uniform(rng);
+      scores[0] = sg ? 1.0 - u * u : u * u;
+      for(size_t i = 1; i < 6; ++i) scores[i] = (1.0 - scores[0]) * uniform(rng) / 2.5;
+      kinBDT = sg ? 2.0 * sqrt(uniform(rng)) - 1.0 : 2.0 * uniform(rng) - 1.0;
+      mass = sg ? peak(rng) : 40.0 + falling(rng);
+      for(float &x : extra) x = uniform(rng);
+      nJet = narray ? njet(rng) : 0;
+      for(int i = 0; i < nJet; ++i) Jet_pt[i] = 20.0 + falling(rng);
+      tree->Fill();
+    }
+    file->WriteTObject(tree);
+    file->Close();
+    nevent_total[!sg] += nentry;
+    clog << "Info: generated " << nentry << " entries: " << filename << endl;
+  }
+
+  string yamlpath = dirpath + "/bench.yaml";
+  ofstream yaml(yamlpath);
+  yaml << "- name: sg\n  is_signal: true\n  samples:\n"
+       << "    - name: bench-sg\n      nevent: " << nevent_total[0] << "\n      xs: 1.0\n"
+       << "- name: bg\n  is_signal: false\n  samples:\n"
+       << "    - name: bench-bg\n      nevent: " << nevent_total[1] << "\n      xs: 100.0\n";
+  if(!yaml) {
+    cerr << "Error: failed to write " << yamlpath << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,218 @@
+#include "TreeInput.h"
+#include "HistOutput.h"
+#include "fs.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <math.h>
+
+using namespace std;
+
+// Timing of one benchmark, best of all repetitions.
+struct BenchResult {
+  string bench;
+  size_t events;
+  size_t bytes;
+  double seconds;
+};
+
+// Output to benchmark filling and rendering.
+class BenchHist : public HistOutput {
+public:
+  BenchHist(const char *filename) : HistOutput("x", "number", filename) { }
+  virtual bool process() override { return true; }
+};
+
+static const char *const DEFAULT_BRANCHES[] = {
+  "ak15_ParTMDV2_Hss", "ak15_ParTMDV2_QCDbb", "ak15_ParTMDV2_QCDb",
+  "ak15_ParTMDV2_QCDcc", "ak15_ParTMDV2_QCDc", "ak15_ParTMDV2_QCDothers",
+  "kinBDT", "ak15_regressed_mass",
+};
+
+// Run body repeat times, keeping the fastest run.
+// body returns the number of events and bytes processed.
+static BenchResult run(const string &bench, size_t repeat, const function<pair<size_t, size_t>()> &body)
+{
+  BenchResult result = { bench, 0, 0, INFINITY };
+  for(size_t i = 0; i < repeat; ++i) {
+    auto start = chrono::steady_clock::now();
+    pair<size_t, size_t> counts = body();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if(seconds < result.seconds) result.events = counts.first, result.bytes = counts.second, result.seconds = seconds;
+  }
+  clog << "Info: " << bench << ": " << result.events << " events in " << result.seconds << " s" << endl;
+  return result;
+}
+
+// Write a result as one JSON object per line.
+static void write_json(ostream &os, const BenchResult &result, const string &tag)
+{
+  double seconds = max(result.seconds, 1e-9);
+  os << "{\"bench\": \"" << result.bench << "\", \"tag\": \"" << tag << "\""
+     << ", \"events\": " << result.events << ", \"bytes\": " << result.bytes
+     << ", \"seconds\": " << result.seconds
+     << ", \"events_per_s\": " << result.events / seconds
+     << ", \"mb_per_s\": " << result.bytes / seconds / 1e6 << "}" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t repeat = 3, nfill = 10000000, nsave = 5;
+  const char *tag = "";
+  const char *outpath = nullptr;
+  vector<string> branches;
+  for(int opt; (opt = getopt(argc, argv, "r:n:s:t:o:b:")) != -1;) {
+    switch(opt) {
+      case 'r': repeat = stoul(optarg); break;
+      case 'n': nfill = stoul(optarg); break;
+      case 's': nsave = stoul(optarg); break;
+      case 't': tag = optarg; break;
+      case 'o': outpath = optarg; break;
+      case 'b': branches.push_back(optarg); break;
+      default: return 1;
+    }
+  }
+  argc -= optind - 1, argv += optind - 1;
+
+  if(argc != 2 || repeat == 0) {
+    cerr << "usage: " << program_invocation_short_name
+         << " [ -r <repeat> ] [ -n <nfill> ] [ -s <nsave> ] [ -t <tag> ] [ -o <output-jsonl> ]"
+         << " [ -b <branch> ] ... <bench-dir>" << endl
+         << "bench-dir is made by bench-gen-tree; results are appended to output-jsonl, or printed." << endl;
+    return 1;
+  }
+  if(branches.empty()) branches.assign(begin(DEFAULT_BRANCHES), end(DEFAULT_BRANCHES));
+
+  string dirpath = argv[1], treedir = dirpath + "/trees";
+  ListDir lsrst(treedir.c_str(), ListDir::DT_ALL & ~ListDir::DT_DIR);
+  lsrst.sort_by_numbers();
+  vector<string> filenames = lsrst.get_full_names();
+  if(filenames.empty()) {
+    cerr << "Error: no trees in " << treedir << endl;
+    return 1;
+  }
+
+  auto make_input = [&]() {
+    TreeInput *input = new TreeInput("Events");
+    for(const string &name : filenames) input->add_filename(name.c_str());
+    for(const string &branch : branches) input->add_branch(branch.c_str());
+    return input;
+  };
+
+  vector<BenchResult> results;
+
+  // Event loop: reading and decompressing requested branches.
+  results.push_back(run("TreeInput::next", repeat, [&]() {
+    unique_ptr<TreeInput> input(make_input());
+    size_t nevent = 0;
+    while(input->next()) ++nevent;
+    return make_pair(nevent, input->get_io_stats().bytes_read);
+  }));
+
+  // Event loop plus access to every requested branch.
+  results.push_back(run("TreeInput::get_branch_data", repeat, [&]() {
+    unique_ptr<TreeInput> input(make_input());
+    size_t nevent = 0, nbranch = input->get_nbranch();
+    volatile double sum = 0.0;
+    while(input->next()) {
+      for(size_t i = 0; i < nbranch; ++i) {
+        size_t nelem;
+        const void *data = input->get_branch_data(i, &nelem);
+        if(data && nelem && input->get_branch_type(i) == 'F') sum = sum + *(const float *)data;
+      }
+      ++nevent;
+    }
+    return make_pair(nevent, input->get_io_stats().bytes_read);
+  }));
+
+  // Filling, with values drawn beforehand so that only filling is timed.
+  vector<double> values(min(nfill, (size_t)1 << 20)), weights(values.size());
+  mt19937_64 rng(0);
+  normal_distribution<double> normal(0.5, 0.2);
+  for(size_t k = 0; k < values.size(); ++k) values[k] = normal(rng), weights[k] = 1.0 + values[k];
+  auto make_hist = [](const char *filename) {
+    BenchHist *hist = new BenchHist(filename);
+    hist->add_curve("sg", true);
+    hist->add_curve("bg");
+    hist->set_boundary(0.0, 1.0);
+    hist->bin();
+    hist->set_logy(true);
+    return hist;
+  };
+  results.push_back(run("HistOutput::fill_curve", repeat, [&]() {
+    unique_ptr<BenchHist> hist(make_hist(nullptr));
+    for(size_t k = 0; k < nfill; ++k) hist->fill_curve(k % 2, values[k % values.size()], weights[k % weights.size()]);
+    return make_pair(nfill, nfill * 2 * sizeof(double));
+  }));
+  results.push_back(run("HistOutput::fill_curve_batch", repeat, [&]() {
+    unique_ptr<BenchHist> hist(make_hist(nullptr));
+    for(size_t k = 0; k < nfill; k += values.size()) {
+      size_t n = min(values.size(), nfill - k);
+      hist->fill_curve_batch(k / values.size() % 2, values.data(), weights.data(), n);
+    }
+    return make_pair(nfill, nfill * 2 * sizeof(double));
+  }));
+
+  // Rendering, counted in saved plots.
+  string pdfpath = dirpath + "/bench-save.pdf";
+  results.push_back(run("HistOutput::save", repeat, [&]() {
+    unique_ptr<BenchHist> hist(make_hist(nullptr));
+    hist->fill_curve_batch(0, values.data(), weights.data(), values.size());
+    hist->fill_curve_batch(1, values.data(), nullptr, values.size());
+    hist->set_filename(pdfpath.c_str());
+    for(size_t i = 0; i < nsave; ++i) hist->save();
+    hist->set_filename(nullptr);
+    return make_pair(nsave, (size_t)Stat(pdfpath.c_str()).size() * nsave);
+  }));
+  remove(pdfpath.c_str());
+
+  // Full TaggerHist chain, run as hist-hss-score next to this executable in
+  // the bench directory, so that plots land there. Counted in input events.
+  char exepath[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", exepath, sizeof exepath - 1);
+  if(len > 0) {
+    exepath[len] = 0;
+    string score = string(exepath, strrchr(exepath, '/') - exepath) + "/hist-hss-score";
+    if(Stat(score.c_str()).isreg()) {
+      size_t nevent = 0, nbyte = 0;
+      {
+        unique_ptr<TreeInput> input(make_input());
+        while(input->next()) ++nevent;
+        for(const string &name : filenames) nbyte += Stat(name.c_str()).size();
+      }
+      ostringstream command;
+      command << "cd '" << dirpath << "' && '" << score << "' bench.yaml 0 1 ak15_ParTMDV2_ Hss sg 1 0.5 0 trees"
+              << " >/dev/null 2>&1";
+      bool ok = true;
+      BenchResult result = run("TaggerHist", repeat, [&]() {
+        ok = ok && system(command.str().c_str()) == 0;
+        return make_pair(nevent, nbyte);
+      });
+      if(ok) results.push_back(result);
+      else cerr << "Warning: failed to run " << command.str() << endl;
+    } else {
+      cerr << "Warning: skipping TaggerHist chain, missing " << score << endl;
+    }
+  }
+
+  ofstream ofs;
+  if(outpath) ofs.open(outpath, ios::app);
+  for(const BenchResult &result : results) write_json(outpath ? ofs : cout, result, tag);
+  if(outpath && !ofs) {
+    cerr << "Error: failed to write " << outpath << endl;
+    return 1;
+  }
+  return 0;
+}
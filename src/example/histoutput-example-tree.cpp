@@ -14,9 +14,9 @@ public:
   }
 
   virtual bool process() override {
-    fill_curve(0, *(float *)get_branch_data(0), 1.0);
-    fill_curve(1, *(float *)get_branch_data(0), 4.0);
-    fill_curve(2, *(float *)get_branch_data(0), 2.0);
+    fill_curve(0, *(const float *)get_branch_data(0), 1.0);
+    fill_curve(1, *(const float *)get_branch_data(0), 4.0);
+    fill_curve(2, *(const float *)get_branch_data(0), 2.0);
     return true;
   }
 };
@@ -0,0 +1,20 @@
+#include "TreeInput.h"
+#include <iostream>
+
+using namespace std;
+
+int main()
+{
+  TreeInput eviewer("Events");
+  eviewer.add_filename("../example/wzdd-nano.root");
+  eviewer.add_filename("../example/wzdd-nano.root");
+  size_t b_pdgid = eviewer.add_branch("GenPart_pdgId");
+  while(size_t nevent = eviewer.next_batch(1024)) {
+    const size_t *offsets;
+    int *pdgid = (int *)eviewer.get_batch_data(b_pdgid, &offsets);
+    size_t nquark = 0;
+    for(size_t i = 0; i < offsets[nevent]; ++i) nquark += pdgid[i] >= -6 && pdgid[i] <= 6;
+    cout << eviewer.get_filename() << '\t' << nevent << '\t' << offsets[nevent] << '\t' << nquark << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,269 @@
+#include "CMS_lumi.h"
+#include "CategorizedTreeInput.h"
+#include "HistOutput.h"
+#include "MultiStep.h"
+#include "ParallelLoop.h"
+#include "Expression.h"
+#include "fs.h"
+#include <yaml-cpp/yaml.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+
+using namespace std;
+
+// Expressions of a plots YAML with variables and constants resolved.
+// Remaining symbols are "xs", "nevent", sample fields listed in
+// "sample_fields", and branches, optionally indexed like "Jet_pt[0]".
+class ExprConfig {
+public:
+  ExprConfig(const char *yamlpath) : yaml_(YAML::LoadFile(yamlpath)) {
+    for(const auto &kv : yaml_["constants"]) constants_.emplace_back(kv.first.as<string>(), kv.second.as<double>());
+    for(const auto &kv : yaml_["variables"]) variables_.emplace_back(kv.first.as<string>(), Expression(kv.second.as<string>().c_str()));
+    for(const YAML::Node &field : yaml_["sample_fields"]) sample_fields_.push_back(field.as<string>());
+  }
+
+  const YAML::Node &get_yaml() const { return yaml_; }
+  const vector<string> &get_sample_fields() const { return sample_fields_; }
+
+  Expression compile(const string &source) const {
+    Expression expr(source.c_str());
+    for(size_t depth = 0;; ++depth) {
+      bool changed = false;
+      for(const auto &var : variables_) changed = expr.substitute(var.first.c_str(), var.second) || changed;
+      if(!changed) break;
+      if(depth > variables_.size()) throw logic_error("cyclic variables in expression: " + source);
+    }
+    for(const auto &constant : constants_) expr.substitute(constant.first.c_str(), constant.second);
+    return expr;
+  }
+
+private:
+  YAML::Node yaml_;
+  vector<pair<string, double>> constants_;
+  vector<pair<string, Expression>> variables_;
+  vector<string> sample_fields_;
+};
+
+class ExprInput;
+
+// Histogram of an expression per category, filled a batch at a time.
+// Events failing the cut of the plot or the global one are skipped.
+class ExprHist : public HistOutput, public MultiStep {
+public:
+  ExprHist(ExprInput *input, const ExprConfig &config, const YAML::Node &plot);
+  void fill(size_t n, const double *weights);
+
+  // Filled by ExprInput::loop() instead.
+  virtual bool process() override { return true; }
+
+private:
+  ExprInput *input_;
+  Expression expr_;
+  unique_ptr<Expression> cut_;
+  vector<size_t> expr_columns_, cut_columns_;
+  vector<double> values_, mask_;
+};
+
+// Categorized input feeding column batches to a chain of ExprHist.
+class ExprInput : public CategorizedTreeInput, public MultiStep {
+public:
+  ExprInput(const char *yamlpath, const ExprConfig &config, size_t batch_size)
+    : CategorizedTreeInput("Events", yamlpath), config_(config), batch_size_(batch_size)
+    , weight_(config.compile(config.get_yaml()["weight"] ? config.get_yaml()["weight"].as<string>() : "1"))
+    , cut_(config.compile(config.get_yaml()["cut"] ? config.get_yaml()["cut"].as<string>() : "1"))
+  {
+    for(const string &field : config.get_sample_fields()) add_sample_field(field.c_str());
+    weight_columns_ = bind(weight_);
+    cut_columns_ = bind(cut_);
+  }
+
+  const ExprConfig &get_config() const { return config_; }
+
+  // Map symbols of an expression to columns, registering branches as needed.
+  vector<size_t> bind(const Expression &expr) {
+    vector<size_t> columns;
+    for(size_t i = 0; i < expr.get_nsymbol(); ++i) {
+      string symbol = expr.get_symbol(i);
+      size_t icolumn = find(symbols_.begin(), symbols_.end(), symbol) - symbols_.begin();
+      if(icolumn == symbols_.size()) {
+        symbols_.push_back(symbol);
+        Column column = { Column::BRANCH, 0, 0 };
+        const vector<string> &fields = config_.get_sample_fields();
+        size_t ifield = find(fields.begin(), fields.end(), symbol) - fields.begin();
+        if(symbol == "xs") {
+          column.kind = Column::XS;
+        } else if(symbol == "nevent") {
+          column.kind = Column::NEVENT;
+        } else if(ifield != fields.size()) {
+          column.kind = Column::FIELD, column.index = ifield;
+        } else {
+          string branch = symbol;
+          size_t bracket = symbol.find('[');
+          if(bracket != string::npos) {
+            branch = symbol.substr(0, bracket);
+            column.element = stoul(symbol.substr(bracket + 1));
+          }
+          column.index = get_branch_index(branch);
+        }
+        columns_.push_back(column);
+      }
+      columns.push_back(icolumn);
+    }
+    return columns;
+  }
+
+  // Columns of expression symbols for the current batch.
+  vector<const double *> get_columns(const vector<size_t> &icolumns) const {
+    vector<const double *> columns;
+    for(size_t i : icolumns) columns.push_back(data_[i].data());
+    return columns;
+  }
+
+  // Global cut of the current batch as 1 or 0.
+  const double *get_cut() const { return cut_values_.data(); }
+
+  virtual void loop() override {
+    while(size_t n = next_batch(batch_size_)) {
+      if(get_icategory() == (size_t)-1) continue;
+      load_columns(n);
+      weight_values_.resize(n);
+      cut_values_.resize(n);
+      weight_.eval(get_columns(weight_columns_).data(), n, weight_values_.data());
+      cut_.eval(get_columns(cut_columns_).data(), n, cut_values_.data());
+      for(EventViewer *viewer : MultiStep::get_tree(this)) {
+        ExprHist *hist = dynamic_cast<ExprHist *>(viewer);
+        if(hist) hist->fill(n, weight_values_.data());
+      }
+    }
+  }
+
+private:
+  struct Column {
+    enum Kind { BRANCH, XS, NEVENT, FIELD } kind;
+    size_t index;  // branch or sample field
+    size_t element;
+  };
+
+  const ExprConfig &config_;
+  size_t batch_size_;
+  Expression weight_, cut_;
+  vector<size_t> weight_columns_, cut_columns_;
+  vector<string> symbols_;
+  vector<Column> columns_;
+  vector<vector<double>> data_;
+  vector<double> weight_values_, cut_values_;
+
+  size_t get_branch_index(const string &branch) {
+    for(size_t i = 0; i < get_nbranch(); ++i) if(branch == get_branch(i)) return i;
+    return add_branch(branch.c_str());
+  }
+
+  // Convert branches to double and broadcast sample constants.
+  void load_columns(size_t n) {
+    data_.resize(columns_.size());
+    for(size_t i = 0; i < columns_.size(); ++i) {
+      const Column &column = columns_[i];
+      vector<double> &data = data_[i];
+      data.resize(n);
+      switch(column.kind) {
+        case Column::XS: fill(data.begin(), data.end(), get_sample_xs()); break;
+        case Column::NEVENT: fill(data.begin(), data.end(), get_sample_nevent_total()); break;
+        case Column::FIELD: fill(data.begin(), data.end(), get_sample_field(column.index)); break;
+        case Column::BRANCH: {
+          const size_t *offsets;
+          const void *raw = get_batch_data(column.index, &offsets);
+          if(!Expression::gather(get_branch_type(column.index), raw, offsets, column.element, n, data.data())) {
+            cerr << "Warning: unsupported type of branch " << get_branch(column.index) << endl;
+            fill(data.begin(), data.end(), NAN);
+          }
+          break;
+        }
+      }
+    }
+  }
+};
+
+ExprHist::ExprHist(ExprInput *input, const ExprConfig &config, const YAML::Node &plot)
+  : HistOutput(plot["title"] ? plot["title"].as<string>().c_str() : plot["name"].as<string>().c_str(),
+      "number", (plot["name"].as<string>() + ".pdf").c_str())
+  , input_(input), expr_(config.compile(plot["expression"].as<string>()))
+{
+  expr_columns_ = input->bind(expr_);
+  if(plot["cut"]) {
+    cut_.reset(new Expression(config.compile(plot["cut"].as<string>())));
+    cut_columns_ = input->bind(*cut_);
+  }
+  size_t ncategory = input->get_ncategory();
+  for(size_t i = 0; i < ncategory; ++i) add_curve(input->get_category(i).c_str(), input->get_category_issignal(i));
+  if(plot["boundary"]) set_boundary(plot["boundary"][0].as<double>(), plot["boundary"][1].as<double>());
+  if(plot["nbin"]) set_nbin(plot["nbin"].as<size_t>());
+  if(plot["boundary"]) bin();
+  set_logy(plot["logy"] && plot["logy"].as<bool>());
+  set_legend_pos(0.65, 0.95, 0.75, 0.9);
+  set_gridy(true);
+}
+
+void ExprHist::fill(size_t n, const double *weights)
+{
+  // Failing events are made non-finite, which fill_curve_batch() skips.
+  values_.resize(n);
+  expr_.eval(input_->get_columns(expr_columns_).data(), n, values_.data());
+  const double *cut = input_->get_cut();
+  if(cut_) {
+    mask_.resize(n);
+    cut_->eval(input_->get_columns(cut_columns_).data(), n, mask_.data());
+    for(size_t k = 0; k < n; ++k) values_[k] = cut[k] != 0.0 && mask_[k] != 0.0 ? values_[k] : NAN;
+  } else {
+    for(size_t k = 0; k < n; ++k) values_[k] = cut[k] != 0.0 ? values_[k] : NAN;
+  }
+  fill_curve_batch(input_->get_icategory(), values_.data(), weights, n);
+}
+
+int main(int argc, char *argv[])
+{
+  size_t nthread = 1;
+  size_t batch_size = 4096;
+  for(int opt; (opt = getopt(argc, argv, "j:b:")) != -1;) {
+    switch(opt) {
+      case 'j': nthread = stoul(optarg); break;
+      case 'b': batch_size = stoul(optarg); break;
+      default: return 1;
+    }
+  }
+  argc -= optind - 1, argv += optind - 1;
+
+  if(argc < 4) {
+    cerr << "usage: " << program_invocation_short_name << " [ -j <nthread> ] [ -b <batch-size> ]"
+         << " <categorization-yaml> <plots-yaml> <dir-to-root-files> [ <more-dir> ... ]" << endl;
+    return 1;
+  }
+
+  ExprConfig config(argv[2]);
+  if(config.get_yaml()["label"]) lumi_sqrtS = config.get_yaml()["label"].as<string>().c_str();
+
+  vector<string> filenames;
+  for(int i = 3; i < argc; ++i) {
+    ListDir lsrst(argv[i], ListDir::DT_ALL & ~ListDir::DT_DIR);
+    lsrst.sort_by_numbers();
+    for(const string &name : lsrst.get_full_names()) filenames.push_back(name);
+  }
+  auto make_input = [&]() {
+    ExprInput *input = new ExprInput(argv[1], config, batch_size);
+    for(const YAML::Node &plot : config.get_yaml()["plots"]) input->add_then(new ExprHist(input, config, plot));
+    return input;
+  };
+
+  unique_ptr<ExprInput> input(make_input());
+  input->list_samples();
+  for(const string &name : filenames) input->add_filename(name.c_str());
+  input->plan();
+  ParallelLoop(input.get(), make_input, nthread).loop();
+  return 0;
+}
@@ -0,0 +1,109 @@
+#include "CMS_lumi.h"
+#include "CutScan.h"
+#include "CutOptimizer.h"
+#include "HistOutput.h"
+#include <TH1.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+
+using namespace std;
+
+// Scan read out by cuts, written by hist-hss-score -s.
+class ScanReadout : public CutScan {
+public:
+  ScanReadout() : CutScan(nullptr, 1, 0.0, 1.0, 1, 0.0, 1.0, 1, 0.0, 1.0) { }
+  virtual bool process() override { return false; }
+};
+
+// Plot of one readout of the scan, along axis 1 (kinBDT) or 2 (Mass).
+class ReadoutHist : public HistOutput {
+public:
+  ReadoutHist(const ScanReadout &scan, int axis, const char *xtitle, const string &filename)
+    : HistOutput(xtitle, "number", filename.c_str()), scan_(scan), axis_(axis)
+  {
+    for(size_t i = 0; i < scan.get_ncurve(); ++i) add_curve(scan.get_curve_title(i), scan.curve_issignal(i));
+    set_boundary(scan.get_bin_edge(axis, 1), scan.get_bin_edge(axis, scan.get_nbin(axis) + 1));
+    set_nbin(scan.get_nbin(axis));
+    bin();
+    set_logy(false);
+    set_legend_pos(0.65, 0.95, 0.75, 0.9);
+    set_gridy(true);
+  }
+
+  void read(double xcut, double ycut) {
+    for(size_t i = 0; i < get_ncurve(); ++i) {
+      vector<double> sumw2;
+      vector<double> sumw = axis_ == 1 ? scan_.project_y(i, xcut, &sumw2) : scan_.project_z(i, xcut, ycut, &sumw2);
+      TH1 *curve = get_curve(i);
+      for(size_t b = 0; b < sumw.size(); ++b) {
+        curve->SetBinContent(b, sumw[b]);
+        curve->SetBinError(b, sqrt(sumw2[b]));
+      }
+    }
+  }
+
+  virtual bool process() override { return false; }
+
+private:
+  const ScanReadout &scan_;
+  int axis_;
+};
+
+int main(int argc, char *argv[])
+{
+  size_t topk = 0;
+  double rel_syst = 0.0;
+  size_t nthread = 0;
+  for(int opt; (opt = getopt(argc, argv, "k:u:j:")) != -1;) {
+    switch(opt) {
+      case 'k': topk = stoul(optarg); break;
+      case 'u': rel_syst = stod(optarg); break;
+      case 'j': nthread = stoul(optarg); break;
+      default: return 1;
+    }
+  }
+  argc -= optind - 1, argv += optind - 1;
+
+  if(argc < 4) {
+    cerr << "usage: " << program_invocation_short_name
+         << " [ -k <top-k> [ -u <relative-bkg-uncertainty> ] [ -j <nthread> ] ] <scan-file> <tagger-threshold> <kinbdt-threshold> [ <lumi-label> ]" << endl;
+    return 1;
+  }
+  if(argc > 4) lumi_sqrtS = argv[4];
+
+  ScanReadout scan;
+  if(!scan.load(argv[1])) {
+    cerr << "Error: failed to load scan: " << argv[1] << endl;
+    return 1;
+  }
+  double tagger_threshold = stod(argv[2]);
+  double kinbdt_threshold = stod(argv[3]);
+  ReadoutHist(scan, 1, "kinBDT", string("kinBDT_") + argv[2] + ".pdf").read(tagger_threshold, 0.0);
+  ReadoutHist(scan, 2, "Mass", string("Mass_") + argv[2] + "_" + argv[3] + ".pdf").read(tagger_threshold, kinbdt_threshold);
+
+  // Yields passing both cuts, with cuts rounded down to bin edges.
+  double xcut = scan.get_bin_edge(0, scan.find_bin(0, tagger_threshold));
+  double ycut = scan.get_bin_edge(1, scan.find_bin(1, kinbdt_threshold));
+  cout << "tagger >= " << xcut << ", kinBDT >= " << ycut << endl;
+  cout << "category\tyield\terror" << endl << scientific << setprecision(3);
+  for(size_t i = 0; i < scan.get_ncurve(); ++i) {
+    double sumw2;
+    double yield = scan.get_yield(i, tagger_threshold, kinbdt_threshold, -INFINITY, INFINITY, &sumw2);
+    cout << scan.get_curve_title(i) << '\t' << yield << '\t' << sqrt(sumw2) << endl;
+  }
+
+  // Best working points in (tagger cut, kinBDT cut, Mass window).
+  if(topk) {
+    CutOptimizer optimizer(scan);
+    if(rel_syst > 0.0) optimizer.set_metric(CutOptimizer::ASIMOV_UNCERTAINTY);
+    optimizer.set_uncertainty(rel_syst);
+    optimizer.set_nthread(nthread);
+    optimizer.print(optimizer.optimize(topk));
+  }
+  return 0;
+}
@@ -1,13 +1,11 @@
 #include "CMS_lumi.h"
 #include "TreeInput.h"
 #include "HistOutput.h"
+#include "CutOptimizer.h"
 #include "fs.h"
 #include <iostream>
-#include <iomanip>
 #include <string>
 #include <vector>
-#include <tuple>
-#include <algorithm>
 #include <stdlib.h>
 #include <math.h>
 #include <errno.h>
@@ -18,12 +16,12 @@ using namespace std;
 class Tree2Hist : public TreeInput, public HistOutput {
 public:
   Tree2Hist(double lb, double ub) : TreeInput("Events"), HistOutput("HssVSQCD", "number", get_output_filename(lb, ub).c_str()) {
-    add_branch("ak15_ParTMDV2_Hss");        // 0
-    add_branch("ak15_ParTMDV2_QCDbb");      // 1
-    add_branch("ak15_ParTMDV2_QCDb");       // 2
-    add_branch("ak15_ParTMDV2_QCDcc");      // 3
-    add_branch("ak15_ParTMDV2_QCDc");       // 4
-    add_branch("ak15_ParTMDV2_QCDothers");  // 5
+    scores_[0] = add_branch<float>("ak15_ParTMDV2_Hss");
+    scores_[1] = add_branch<float>("ak15_ParTMDV2_QCDbb");
+    scores_[2] = add_branch<float>("ak15_ParTMDV2_QCDb");
+    scores_[3] = add_branch<float>("ak15_ParTMDV2_QCDcc");
+    scores_[4] = add_branch<float>("ak15_ParTMDV2_QCDc");
+    scores_[5] = add_branch<float>("ak15_ParTMDV2_QCDothers");
     add_curve("Wlv_Zdd");  // 0
     add_curve("Wlv_Zuu");  // 1
     add_curve("Wlv_Zss");  // 2
@@ -44,8 +42,8 @@ public:
 
     // Extract Hss and QCD scores.
     double Hss, QCD = 0.0;
-    Hss = *(float *)get_branch_data(0);
-    for(size_t i = 1; i <= 5; ++i) QCD += *(float *)get_branch_data(i);
+    Hss = *scores_[0];
+    for(size_t i = 1; i <= 5; ++i) QCD += *scores_[i];
 
     // Compute Hss significance relevant to QCD.
     if(Hss < 0 || QCD < 0) return false;
@@ -59,6 +57,8 @@ public:
   }
 
 private:
+  Branch<float> scores_[6];  // Hss, then QCD ones
+
   static int parse_pid(string path) {
     // *-<PID>_<ID>_tree.root
     if(path.length() < 12) return 0;
@@ -81,44 +81,11 @@ private:
   }
 
   void optimize() const {
-    size_t nbin = get_nbin();
-    if(nbin == 0) return;
-
-    double s_total, b_total = 0.0;
-    double sf = 1e6 / 7395487;  // [XXX] Scale to 10^6 events (100/fb).
-    vector<Double_t *> integrals(4);
-    vector<Double_t> totals(4);
-    for(size_t i = 0; i < 4; ++i) {
-      integrals[i] = get_curve(i)->GetIntegral();
-      totals[i] = get_curve(i)->GetEffectiveEntries() * sf;
-      if(i == 2) s_total = integrals[i][nbin] * totals[i];
-      else b_total += integrals[i][nbin] * totals[i];
-    }
-
-    vector<tuple<double, double, double, double>> significance;
-    significance.reserve(nbin - 1);
-    for(size_t left_last_bin = 0; left_last_bin < nbin; ++left_last_bin) {
-      double s_left, b_left = 0.0;
-      for(size_t i = 0; i < 4; ++i) {
-        if(i == 2) s_left = integrals[i][left_last_bin] * totals[i];
-        else b_left += integrals[i][left_last_bin] * totals[i];
-      }
-      double s_right = s_total - s_left;
-      double b_right = b_total - b_left;
-      double sig = get_signal_significance(s_right, b_right);
-      if(!isfinite(sig)) sig = 0.0;
-      significance.emplace_back(sig, get_curve(0)->GetBinLowEdge(left_last_bin + 1), s_right, b_right);
-    }
-    sort(significance.begin(), significance.end());
-    reverse(significance.begin(), significance.end());
-    cout << "sig.\tpos.\tsg.\tbg." << endl << scientific << setprecision(1);
-    for(const auto &rec : significance) {
-      cout << get<0>(rec) << '\t' << get<1>(rec) << '\t' << get<2>(rec) << '\t' << get<3>(rec) << endl;
-    }
-  }
-
-  static double get_signal_significance(double s, double b) {
-    return sqrt(2 * ((s + b) * log(1 + s / b) - s));
+    CutOptimizer optimizer(*this);
+    optimizer.set_nthread(1);  // At most nbin + 1 working points.
+    for(size_t i = 0; i < 4; ++i) optimizer.set_signal(i, i == 2);
+    optimizer.set_scale(1e6 / 7395487);  // [XXX] Scale to 10^6 events (100/fb).
+    optimizer.print(optimizer.optimize(get_nbin()));
   }
 };
 
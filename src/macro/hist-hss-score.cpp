@@ -1,17 +1,22 @@
 #include "CMS_lumi.h"
 #include "CategorizedTreeInput.h"
 #include "HistOutput.h"
+#include "CutScan.h"
+#include "CutOptimizer.h"
 #include "MultiStep.h"
-#include <yaml-cpp/yaml.h>
+#include "Pipeline.h"
+#include "ParallelLoop.h"
+#include "Hasher.h"
+#include "Ledger.h"
 #include "fs.h"
-#include <sstream>
 #include <iostream>
-#include <iomanip>
 #include <string>
 #include <vector>
-#include <tuple>
 #include <algorithm>
+#include <memory>
 #include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
 #include <math.h>
 #include <errno.h>
 #include <ctype.h>
@@ -19,6 +24,17 @@
 
 using namespace std;
 
+// Histogram outputs of a tree of viewers.
+static vector<HistOutput *> get_hist_outputs(EventViewer *viewer)
+{
+  vector<HistOutput *> hists;
+  for(EventViewer *node : MultiStep::get_tree(viewer)) {
+    HistOutput *hist = dynamic_cast<HistOutput *>(node);
+    if(hist) hists.push_back(hist);
+  }
+  return hists;
+}
+
 class TaggerHist : public CategorizedTreeInput, public HistOutput, public MultiStep {
 public:
   TaggerHist(const char *yamlpath, double lb, double ub,
@@ -29,14 +45,15 @@ public:
         get_output_filename(signal_branch_suffix, lb, ub).c_str())
     , signal_category_(signal_category), luminosity_(luminosity), threshold_(threshold)
   {
-    add_branch((branch_prefix + signal_branch_suffix).c_str());  // 0
-    add_branch((branch_prefix + "QCDbb").c_str());               // 1
-    add_branch((branch_prefix + "QCDb").c_str());                // 2
-    add_branch((branch_prefix + "QCDcc").c_str());               // 3
-    add_branch((branch_prefix + "QCDc").c_str());                // 4
-    add_branch((branch_prefix + "QCDothers").c_str());           // 5
+    scores_[0] = add_branch<float>((branch_prefix + signal_branch_suffix).c_str());
+    scores_[1] = add_branch<float>((branch_prefix + "QCDbb").c_str());
+    scores_[2] = add_branch<float>((branch_prefix + "QCDb").c_str());
+    scores_[3] = add_branch<float>((branch_prefix + "QCDcc").c_str());
+    scores_[4] = add_branch<float>((branch_prefix + "QCDc").c_str());
+    scores_[5] = add_branch<float>((branch_prefix + "QCDothers").c_str());
     size_t ncategory = get_ncategory();
     for(size_t i = 0; i < ncategory; ++i) {
+      set_category_issignal(i, get_category(i) == signal_category_);
       add_curve(get_category(i).c_str(), category_issignal(i));
     }
     set_boundary(lb, ub);
@@ -46,7 +63,7 @@ public:
     set_gridy(true);
   }
 
-  ~TaggerHist() { /* optimize(); */ post_process(); }
+  ~TaggerHist() { if(topk_) optimize(); if(!is_loaded()) post_process(); }
 
   virtual bool process() override {
     // Compute weight of current event.
@@ -54,8 +71,8 @@ public:
 
     // Extract Hss and QCD scores.
     double Hss, QCD = 0.0;
-    Hss = *(float *)get_branch_data(0);
-    for(size_t i = 1; i <= 5; ++i) QCD += *(float *)get_branch_data(i);
+    Hss = *scores_[0];
+    for(size_t i = 1; i <= 5; ++i) QCD += *scores_[i];
 
     // Compute Hss significance relevant to QCD.
     if(Hss < 0 || QCD < 0) return false;
@@ -65,78 +82,35 @@ public:
 
     // Submit result.
     this->fill_curve(get_icategory(), HssVSQCD, weight);
+    score_ = HssVSQCD;
     return HssVSQCD >= threshold_;
   }
 
   double get_sample_weight() const {
-    YAML::Node sample;
-    get_sample_configuration(&sample);
-    return sample["xs"].as<double>() * 1e3 * luminosity_ / sample["nevent"].as<double>();
+    return get_sample_xs() * 1e3 * luminosity_ / get_sample_nevent_total();
   }
 
-  bool category_issignal(const string &category) const { return category == signal_category_; }
-  bool category_issignal(size_t i) const { return category_issignal(get_category(i)); }
-  bool category_issignal() const { return category_issignal(get_category()); }
+  bool category_issignal(size_t i) const { return get_category_issignal(i); }
+  bool category_issignal() const { return get_category_issignal(); }
+  double get_score() const { return score_; }  // HssVSQCD of current event
 
-private:
-  string signal_category_;
-  double luminosity_;
-  double threshold_;
+  // Known trees are run as pipelines, others through MultiStep.
+  virtual void loop() override;
 
-  static string get_output_ytitle(const string &signal_branch_suffix) {
-    return signal_branch_suffix + "VSQCD";
-  }
+  // Files current in the ledger are skipped; others are recorded on close
+  // with the histograms of the chain, which then restart empty.
+  void set_ledger(Ledger *ledger) { ledger_ = ledger; }
+  // Print the best topk cuts on HssVSQCD when done, 0 disabling.
+  void set_topk(size_t topk) { topk_ = topk; }
 
-  static string get_output_filename(const string &signal_branch_suffix, double lb, double ub) {
-    return get_output_ytitle(signal_branch_suffix) + "_" + to_string(lb) + "_" + to_string(ub) + ".pdf";
-  }
-
-  void optimize() const {
-    size_t nbin = get_nbin();
-    if(nbin == 0) return;
-
-    size_t ncurve = get_ncurve();
-    double s_total, b_total = 0.0;
-    vector<char> is_signal(ncurve);
-    vector<Double_t *> integrals(ncurve);
-    vector<Double_t> totals(ncurve);
-    for(size_t i = 0; i < ncurve; ++i) {
-      is_signal[i] = category_issignal(i);
-      integrals[i] = get_curve(i)->GetIntegral();
-      totals[i] = get_curve(i)->GetSumOfWeights();
-      if(is_signal[i]) s_total = integrals[i][nbin] * totals[i];
-      else b_total += integrals[i][nbin] * totals[i];
-    }
-
-    vector<tuple<double, double, double, double>> significance;
-    significance.reserve(nbin - 1);
-    for(size_t left_last_bin = 0; left_last_bin < nbin; ++left_last_bin) {
-      double s_left, b_left = 0.0;
-      for(size_t i = 0; i < ncurve; ++i) {
-        if(is_signal[i]) s_left = integrals[i][left_last_bin] * totals[i];
-        else b_left += integrals[i][left_last_bin] * totals[i];
-      }
-      double s_right = s_total - s_left;
-      double b_right = b_total - b_left;
-      double sig = get_signal_significance(s_right, b_right);
-      if(!isfinite(sig)) sig = 0.0;
-      significance.emplace_back(sig, get_curve(0)->GetBinLowEdge(left_last_bin + 1), s_right, b_right);
-    }
-    sort(significance.begin(), significance.end());
-    reverse(significance.begin(), significance.end());
-    cout << "sig.\tpos.\tsg.\tbg." << endl << scientific << setprecision(1);
-    for(const auto &rec : significance) {
-      cout << get<0>(rec) << '\t' << get<1>(rec) << '\t' << get<2>(rec) << '\t' << get<3>(rec) << endl;
-    }
-  }
-
-  static double get_signal_significance(double s, double b) {
-    return sqrt(2 * ((s + b) * log(1 + s / b) - s));
+  virtual bool want_file(size_t ifilename, const char *filename) const override {
+    if(ledger_ && ledger_->is_current(filename)) return false;
+    return CategorizedTreeInput::want_file(ifilename, filename);
   }
 
+  // Record events per category, and fit the y-range once all events are in.
   void post_process() {
     size_t ncurve = get_ncurve();
-    double ymax = 0.0;
     for(size_t i = 0; i < ncurve; ++i) {
       // Compute total xs and nb for each category.
       double xs = 0.0;
@@ -144,30 +118,44 @@ private:
       size_t nb_read = 0;
       size_t nsample = get_nsample(i);
       for(size_t j = 0; j < nsample; ++j) {
-        YAML::Node sample; get_sample_configuration(i, j, &sample);
-        xs += sample["xs"].as<double>();
-        nb_orig += sample["nevent"].as<size_t>();
+        xs += get_sample_xs(i, j);
+        nb_orig += get_sample_nevent_total(i, j);
         nb_read += get_sample_nevent(i, j);
       }
-      TH1 *curve = get_curve(i);
-
-      // Add xs and nb info.
-      ostringstream oss;
-      oss << " (" << nb_read << "/" << nb_orig << " events scaled to "
-          << scientific << setprecision(3) << xs << " pb)";
-      string title = curve->GetTitle();
-      title += oss.str();
-      curve->SetTitle(title.c_str());
-
-      // Compute maximum bin height.
-      size_t nbin = get_nbin();
-      for(size_t j = 1; j <= nbin; ++j) {
-        ymax = max(ymax, curve->GetBinContent(j));
-      }
+      set_curve_nevent(i, nb_read, nb_orig, xs);
     }
-    // Adjust y-range.
-    set_rangey(0.8 * (signal_category_[1] == 'h' ? 0.001 : 1.0), ymax * 1.2);
+    set_rangey_fit(0.8 * (signal_category_[1] == 'h' ? 0.001 : 1.0));
+  }
+
+  virtual void on_close_file() override {
+    CategorizedTreeInput::on_close_file();
+    if(ledger_) ledger_->record(TreeInput::get_filename(), get_local_index() - get_entry_begin(), get_hist_outputs(this));
+  }
+
+private:
+  string signal_category_;
+  double luminosity_;
+  double threshold_;
+  Branch<float> scores_[6];  // signal, then QCD ones
+  double score_;
+  Ledger *ledger_ = nullptr;
+  size_t topk_ = 0;
+
+  static string get_output_ytitle(const string &signal_branch_suffix) {
+    return signal_branch_suffix + "VSQCD";
+  }
+
+  static string get_output_filename(const string &signal_branch_suffix, double lb, double ub) {
+    return get_output_ytitle(signal_branch_suffix) + "_" + to_string(lb) + "_" + to_string(ub) + ".pdf";
   }
+
+  // Print best cuts on HssVSQCD.
+  void optimize() const {
+    CutOptimizer optimizer(*this);
+    optimizer.set_nthread(1);  // At most nbin + 1 working points.
+    optimizer.print(optimizer.optimize(topk_));
+  }
+
 };
 
 class KinBDTHist : public HistOutput, public MultiStep {
@@ -176,7 +164,7 @@ public:
     : HistOutput("kinBDT", "number", get_output_filename(lb, ub).c_str())
     , tagger_(tagger), threshold_(threshold)
   {
-    ikinBDT_ = tagger->add_branch("kinBDT");
+    kinBDT_ = tagger->add_branch<float>("kinBDT", true);
     size_t ncategory = tagger->get_ncategory();
     for(size_t i = 0; i < ncategory; ++i) {
       add_curve(tagger->get_category(i).c_str(), tagger->category_issignal(i));
@@ -188,26 +176,28 @@ public:
     set_gridy(true);
   }
 
-private:
-  TaggerHist *tagger_;
-  double threshold_;
-  size_t ikinBDT_;
-
-  static string get_output_filename(double lb, double ub) {
-    return "kinBDT_" + to_string(lb) + "_" + to_string(ub) + ".pdf";
-  }
-
   virtual bool process() override {
     // Compute weight of current event.
     double weight = tagger_->get_sample_weight();
 
-    // Extract kinBDT score.
-    double kinBDT = *(float *)tagger_->get_branch_data(ikinBDT_);
+    // Extract kinBDT score, read only for events reaching here.
+    const float *pkinBDT = kinBDT_.get();
+    if(!pkinBDT) return false;
+    double kinBDT = *pkinBDT;
 
     // Submit result.
     this->fill_curve(tagger_->get_icategory(), kinBDT, weight);
     return kinBDT >= threshold_;
   }
+
+private:
+  TaggerHist *tagger_;
+  double threshold_;
+  TreeInput::Branch<float> kinBDT_;
+
+  static string get_output_filename(double lb, double ub) {
+    return "kinBDT_" + to_string(lb) + "_" + to_string(ub) + ".pdf";
+  }
 };
 
 class MassHist : public HistOutput, public MultiStep {
@@ -216,7 +206,7 @@ public:
     : HistOutput("Mass", "number", get_output_filename(lb, ub).c_str())
     , tagger_(tagger), threshold_(threshold)
   {
-    iMass_ = tagger->add_branch("ak15_regressed_mass");
+    Mass_ = tagger->add_branch<float>("ak15_regressed_mass", true);
     size_t ncategory = tagger->get_ncategory();
     for(size_t i = 0; i < ncategory; ++i) {
       add_curve(tagger->get_category(i).c_str(), tagger->category_issignal(i));
@@ -228,50 +218,295 @@ public:
     set_gridy(true);
   }
 
+  virtual bool process() override {
+    // Compute weight of current event.
+    double weight = tagger_->get_sample_weight();
+
+    // Extract Mass score, read only for events reaching here.
+    const float *pMass = Mass_.get();
+    if(!pMass) return false;
+    double Mass = *pMass;
+
+    // Submit result.
+    this->fill_curve(tagger_->get_icategory(), Mass, weight);
+    return Mass >= threshold_;
+  }
+
 private:
   TaggerHist *tagger_;
   double threshold_;
-  size_t iMass_;
+  TreeInput::Branch<float> Mass_;
 
   static string get_output_filename(double lb, double ub) {
     return "Mass_" + to_string(lb) + "_" + to_string(ub) + ".pdf";
   }
+};
+
+// Weighted events per category passing the tagger cut, then also the kinBDT
+// cut, then also the mass cut unless its threshold is NAN.
+class CutflowHist : public HistOutput, public MultiStep {
+public:
+  CutflowHist(TaggerHist *tagger, double kinbdt_threshold, double mass_threshold)
+    : HistOutput("cut", "number", "Cutflow.pdf")
+    , tagger_(tagger), kinbdt_threshold_(kinbdt_threshold), mass_threshold_(mass_threshold)
+  {
+    kinBDT_ = tagger->add_branch<float>("kinBDT", true);
+    if(!std::isnan(mass_threshold_)) Mass_ = tagger->add_branch<float>("ak15_regressed_mass", true);
+    size_t ncategory = tagger->get_ncategory();
+    for(size_t i = 0; i < ncategory; ++i) {
+      add_curve(tagger->get_category(i).c_str(), tagger->category_issignal(i));
+    }
+    size_t nstep = std::isnan(mass_threshold_) ? 2 : 3;
+    set_boundary(0.0, nstep);
+    set_nbin(nstep);
+    bin();
+    set_logy(true);
+    set_legend_pos(0.65, 0.95, 0.75, 0.9);
+    set_gridy(true);
+  }
 
   virtual bool process() override {
-    // Compute weight of current event.
     double weight = tagger_->get_sample_weight();
+    size_t icategory = tagger_->get_icategory();
+    this->fill_curve(icategory, 0.5, weight);
+    const float *pkinBDT = kinBDT_.get();
+    if(!pkinBDT || *pkinBDT < kinbdt_threshold_) return true;
+    this->fill_curve(icategory, 1.5, weight);
+    if(std::isnan(mass_threshold_)) return true;
+    const float *pMass = Mass_.get();
+    if(!pMass || *pMass < mass_threshold_) return true;
+    this->fill_curve(icategory, 2.5, weight);
+    return true;
+  }
 
-    // Extract Mass score.
-    double Mass = *(float *)tagger_->get_branch_data(iMass_);
+private:
+  TaggerHist *tagger_;
+  double kinbdt_threshold_;
+  double mass_threshold_;
+  TreeInput::Branch<float> kinBDT_;
+  TreeInput::Branch<float> Mass_;
+};
 
-    // Submit result.
-    this->fill_curve(tagger_->get_icategory(), Mass, weight);
-    return Mass >= threshold_;
+// Scan of (HssVSQCD, kinBDT, Mass) to read out any pair of cuts afterwards.
+class ScanHist : public CutScan, public MultiStep {
+public:
+  ScanHist(TaggerHist *tagger, const char *filename, double lb, double ub)
+    : CutScan(filename, tagger->get_nbin(), lb, ub, tagger->get_nbin(), lb, ub, tagger->get_nbin(), lb, ub)
+    , tagger_(tagger)
+  {
+    kinBDT_ = tagger->add_branch<float>("kinBDT");
+    Mass_ = tagger->add_branch<float>("ak15_regressed_mass");
+    size_t ncategory = tagger->get_ncategory();
+    for(size_t i = 0; i < ncategory; ++i) {
+      add_curve(tagger->get_category(i).c_str(), tagger->category_issignal(i));
+    }
   }
+
+  virtual bool process() override {
+    double weight = tagger_->get_sample_weight();
+    double kinBDT = *kinBDT_;
+    double Mass = *Mass_;
+    this->fill_curve(tagger_->get_icategory(), tagger_->get_score(), kinBDT, Mass, weight);
+    return true;
+  }
+
+private:
+  TaggerHist *tagger_;
+  TreeInput::Branch<float> kinBDT_;
+  TreeInput::Branch<float> Mass_;
 };
 
+void TaggerHist::loop()
+{
+  if(run_fanout<TaggerHist, KinBDTHist, MassHist, CutflowHist>(this)) return;
+  if(run_pipeline<TaggerHist, ScanHist>(this)) return;
+  EventViewer::loop();
+}
+
 int main(int argc, char *argv[])
 {
+  size_t nthread = 1;
+  size_t nprefetch = 1;
+  const char *cachedir = nullptr;
+  string scanfile_buf;
+  const char *scanfile = nullptr;
+  const char *ledgerdir = nullptr;
+  const char *planfile = nullptr;
+  double progress_interval = 0.0;
+  size_t topk = 0;
+  double mass_threshold = NAN;
+  size_t ishard = 0, nshard = 0;
+  static const struct option long_options[] = {
+    { "shard", required_argument, nullptr, 'S' },
+    { "plan", required_argument, nullptr, 'L' },
+    { nullptr, 0, nullptr, 0 },
+  };
+  for(int opt; (opt = getopt_long(argc, argv, "j:p:c:s:l:Pr:k:m:", long_options, nullptr)) != -1;) {
+    switch(opt) {
+      case 'j': nthread = stoul(optarg); break;
+      case 'p': nprefetch = stoul(optarg); break;
+      case 'c': cachedir = optarg; break;
+      case 's': scanfile = optarg; break;
+      case 'l': ledgerdir = optarg; break;
+      case 'P': EventViewer::set_profiling(true); break;
+      case 'r': progress_interval = stod(optarg); break;
+      case 'k': topk = stoul(optarg); break;
+      case 'm': mass_threshold = stod(optarg); break;
+      case 'L': planfile = optarg; break;
+      case 'S':
+        if(sscanf(optarg, "%zu/%zu", &ishard, &nshard) != 2 || ishard >= nshard) {
+          cerr << "Error: invalid shard, expecting <i>/<N> with i < N: " << optarg << endl;
+          return 1;
+        }
+        break;
+      default: return 1;
+    }
+  }
+  argc -= optind - 1, argv += optind - 1;
+
   if(argc < 11) {
-    cerr << "usage: " << program_invocation_short_name << " <categorization-yaml>"
+    cerr << "usage: " << program_invocation_short_name << " [ -j <nthread> ] [ -p <nprefetch> ] [ -c <cache-dir> ] [ -s <scan-file> ] [ -l <ledger-dir> ] [ -P ] [ -r <progress-interval> ] [ -k <top-k> ] [ -m <cutflow-mass-threshold> ] [ --shard <i>/<N> ] [ --plan <plan-file> ] <categorization-yaml>"
          << " <lower-bound> <upper-bound> <branch-prefix> <signal-branch-suffix>"
          << " <signal-category> <luminosity> <tagger-threshold> <kinbdt-threshold>"
          << " <dir-to-root-files> [ <more-dir> ... ]"
          << endl;
     return 1;
   }
+  if(ledgerdir && scanfile) {
+    cerr << "Error: scans cannot be recorded in a ledger" << endl;
+    return 1;
+  }
+  if(cachedir && nshard) {
+    cerr << "Error: shards cannot be cached; merge them with hist-merge instead" << endl;
+    return 1;
+  }
   lumi_sqrtS = (dotsplit(basename(argv[1])).first + " " + argv[7] + "/fb").c_str();
 
-  TaggerHist tagger_hist(argv[1], stod(argv[2]), stod(argv[3]), argv[4], argv[5], argv[6], stod(argv[7]), stod(argv[8]));
-  (&tagger_hist)
-    ->then(new KinBDTHist(&tagger_hist, stod(argv[2]), stod(argv[3]), stod(argv[9])))
-    ->then(new MassHist(&tagger_hist, stod(argv[2]), stod(argv[3]), 0.0))
-    ;
+  // Shards write mergeable histograms and scans named after the shard, see hist-merge.
+  string shard_suffix = nshard ? ".shard" + to_string(ishard) + "of" + to_string(nshard) + ".root" : "";
+  if(scanfile && nshard) scanfile = (scanfile_buf = scanfile + shard_suffix).c_str();
+
+  // A scan fills all events once instead of plots after fixed cuts.
+  unique_ptr<Ledger> ledger;
+  auto make_tagger_hist = [argv, nprefetch, scanfile, mass_threshold, &ledger]() {
+    double threshold = scanfile ? -INFINITY : stod(argv[8]);
+    TaggerHist *tagger_hist = new TaggerHist(argv[1], stod(argv[2]), stod(argv[3]), argv[4], argv[5], argv[6], stod(argv[7]), threshold);
+    tagger_hist->set_prefetch(nprefetch);
+    tagger_hist->set_ledger(ledger.get());
+    if(scanfile) {
+      tagger_hist->then(new ScanHist(tagger_hist, scanfile, stod(argv[2]), stod(argv[3])));
+      return tagger_hist;
+    }
+    // Plots after the tagger cut are independent, sharing branches read once.
+    tagger_hist->add_then(new KinBDTHist(tagger_hist, stod(argv[2]), stod(argv[3]), stod(argv[9])));
+    tagger_hist->add_then(new MassHist(tagger_hist, stod(argv[2]), stod(argv[3]), 0.0));
+    tagger_hist->add_then(new CutflowHist(tagger_hist, stod(argv[9]), mass_threshold));
+    return tagger_hist;
+  };
+  vector<string> filenames;
   for(int i = 10; i < argc; ++i) {
     ListDir lsrst(argv[i], ListDir::DT_ALL & ~ListDir::DT_DIR);
     lsrst.sort_by_numbers();
-    for(const string &name : lsrst.get_full_names()) tagger_hist.add_filename(name.c_str());
+    for(const string &name : lsrst.get_full_names()) filenames.push_back(name);
+  }
+  auto make_master = [&]() {
+    TaggerHist *tagger_hist = make_tagger_hist();
+    for(const string &name : filenames) tagger_hist->add_filename(name.c_str());
+    if(nshard) tagger_hist->select_shard(ishard, nshard);
+    tagger_hist->set_topk(topk);  // Printed once, by the master.
+    return tagger_hist;
+  };
+  unique_ptr<TaggerHist> tagger_hist(make_master());
+  tagger_hist->list_samples();
+  tagger_hist->plan();
+
+  // Histograms are cached by inputs and cuts; rendering from a hit skips the loop.
+  // Scans and ledger runs are not cached, so they always loop.
+  if(cachedir && !scanfile && !ledgerdir) {
+    Hasher hasher;
+    tagger_hist->hash_inputs(hasher);
+    for(int i = 1; i < 10; ++i) hasher.update(argv[i]);
+    hasher.update(mass_threshold);
+    vector<string> cache_filenames;
+    bool hit = true;
+    for(HistOutput *hist : get_hist_outputs(tagger_hist.get())) {
+      string cache_filename = string(cachedir) + "/" + basename(hist->get_filename()) + "." + hasher.hexdigest() + ".root";
+      hit = hit && Stat(cache_filename.c_str()).isreg();
+      cache_filenames.push_back(cache_filename);
+    }
+    vector<HistOutput *> hists = get_hist_outputs(tagger_hist.get());
+    if(hit) {
+      for(size_t i = 0; hit && i < hists.size(); ++i) hit = hists[i]->load_cache(cache_filenames[i].c_str());
+      if(hit) {
+        clog << "Info: rendering cached histograms: " << hasher.hexdigest() << endl;
+        return 0;
+      }
+      // Drop partially loaded caches.
+      for(HistOutput *hist : hists) hist->set_filename(nullptr);
+      tagger_hist.reset(make_master());
+      tagger_hist->plan();
+      hists = get_hist_outputs(tagger_hist.get());
+    }
+    for(size_t i = 0; i < hists.size(); ++i) hists[i]->set_cache_filename(cache_filenames[i].c_str());
+  }
+
+  // Only files new or changed since the last run with the same configuration are read.
+  vector<size_t> recorded;
+  if(ledgerdir) {
+    Hasher hasher;
+    hasher.update_file(argv[1]);
+    for(int i = 1; i < 10; ++i) hasher.update(argv[i]);
+    hasher.update(mass_threshold);
+    // Runs over other directories or shards prune each other's records, so
+    // they are kept apart.
+    for(int i = 10; i < argc; ++i) hasher.update(argv[i]);
+    hasher.update((uint64_t)ishard).update((uint64_t)nshard);
+    // Partials are kept per output, so outputs are part of the key.
+    for(HistOutput *hist : get_hist_outputs(tagger_hist.get())) hasher.update(basename(hist->get_filename()));
+    ledger.reset(new Ledger((string(ledgerdir) + "/" + hasher.hexdigest()).c_str()));
+    vector<string> current_filenames;
+    for(size_t i = 0; i < tagger_hist->get_nfilename(); ++i) current_filenames.push_back(tagger_hist->TreeInput::get_filename(i));
+    ledger->prune(current_filenames);
+    for(size_t i = 0; i < current_filenames.size(); ++i) {
+      if(ledger->is_current(current_filenames[i].c_str())) recorded.push_back(i);
+    }
+    clog << "Info: " << recorded.size() << " of " << current_filenames.size() << " files unchanged since last run" << endl;
+    tagger_hist->set_ledger(ledger.get());
+  }
+
+  // All files are checked up front, and problems reported before reading any.
+  if(planfile) tagger_hist->plan_files(nthread, planfile);
+  if(progress_interval > 0.0) {
+    if(!tagger_hist->is_scanned()) tagger_hist->scan_files(nthread);
+    tagger_hist->set_progress_interval(progress_interval);
+  }
+  // Ledger records are per file, so files are not split.
+  ParallelLoop parallel_loop(tagger_hist.get(), make_tagger_hist, nthread);
+  parallel_loop.set_split_files(!ledger);
+  parallel_loop.loop();
+
+  // Histograms are summed from partials of all files in the ledger.
+  if(ledger) {
+    if(!ledger->save()) cerr << "Warning: failed to save ledger in " << ledger->get_dirpath() << endl;
+    for(size_t i : recorded) {
+      size_t nevent = ledger->get_nevent(tagger_hist->TreeInput::get_filename(i));
+      tagger_hist->add_sample_nevent(tagger_hist->get_file_icategory(i), tagger_hist->get_file_isample(i), nevent);
+    }
+    if(!ledger->sum(get_hist_outputs(tagger_hist.get()))) cerr << "Warning: histograms miss some partials" << endl;
+  }
+
+  // Histograms of a shard are saved with their event counts and left
+  // unrendered; hist-merge sums them and renders as a single run would.
+  if(nshard) {
+    tagger_hist->post_process();
+    for(HistOutput *hist : get_hist_outputs(tagger_hist.get())) {
+      string shard_filename = basename(hist->get_filename()) + shard_suffix;
+      if(!hist->save_cache(shard_filename.c_str())) {
+        cerr << "Warning: failed to save shard: " << shard_filename << endl;
+      }
+      hist->set_cache_filename(nullptr);
+      hist->set_filename(nullptr);
+    }
   }
-  tagger_hist.loop();
   return 0;
 }
@@ -0,0 +1,68 @@
+#include "CMS_lumi.h"
+#include "HistOutput.h"
+#include "CutScan.h"
+#include <iostream>
+#include <string>
+#include <memory>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Histograms loaded from cache files, as written by hist-hss-score --shard.
+class MergedHist : public HistOutput {
+public:
+  MergedHist(const char *filename) : HistOutput("", "", "") { set_filename(filename); }
+  virtual bool process() override { return false; }
+};
+
+// Scans loaded from files, as written by hist-hss-score -s --shard.
+class MergedScan : public CutScan {
+public:
+  MergedScan(const char *filename) : CutScan(filename, 1, 0.0, 1.0, 1, 0.0, 1.0, 1, 0.0, 1.0) { }
+  virtual bool process() override { return false; }
+};
+
+template<class T>
+static bool merge_files(int argc, char *argv[], bool (T::*load)(const char *))
+{
+  unique_ptr<T> output(new T(nullptr));
+  for(int i = 2; i < argc; ++i) {
+    unique_ptr<T> input(new T(nullptr));
+    if(!((i == 2 ? output.get() : input.get())->*load)(argv[i])) {
+      cerr << "Error: failed to load: " << argv[i] << endl;
+      return false;
+    }
+    if(i > 2 && !output->merge(*input)) {
+      cerr << "Error: failed to merge incompatible file: " << argv[i] << endl;
+      return false;
+    }
+  }
+  output->set_filename(argv[1]);
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  for(int opt; (opt = getopt(argc, argv, "l:")) != -1;) {
+    switch(opt) {
+      case 'l': lumi_sqrtS = optarg; break;
+      default: return 1;
+    }
+  }
+  argc -= optind - 1, argv += optind - 1;
+
+  if(argc < 3) {
+    cerr << "usage: " << program_invocation_short_name << " [ -l <lumi-label> ]"
+         << " <output-pdf-or-scan-file> <shard-file> [ <more-shard-file> ... ]" << endl;
+    return 1;
+  }
+
+  // PDF outputs render merged histograms; others are merged scans.
+  const char *suffix = strrchr(argv[1], '.');
+  bool ok = suffix && strcmp(suffix, ".pdf") == 0
+    ? merge_files<MergedHist>(argc, argv, &HistOutput::load_cache)
+    : merge_files<MergedScan>(argc, argv, &CutScan::load);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,45 @@
+#include "CategorizedTreeInput.h"
+#include "SkimOutput.h"
+#include "fs.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unistd.h>
+#include <errno.h>
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+  vector<string> branches;
+  const char *yamlpath = nullptr;
+  for(int opt; (opt = getopt(argc, argv, "b:y:")) != -1;) {
+    switch(opt) {
+      case 'b': branches.push_back(optarg); break;
+      case 'y': yamlpath = optarg; break;
+      default: return 1;
+    }
+  }
+  argc -= optind - 1, argv += optind - 1;
+
+  if(argc < 3 || branches.empty()) {
+    cerr << "usage: " << program_invocation_short_name
+         << " -b <branch> [ -b <more-branch> ... ] [ -y <categorization-yaml> ]"
+         << " <output-dir> <dir-to-root-files> [ <more-dir> ... ]" << endl;
+    return 1;
+  }
+
+  // Files matching no sample are skipped if categorized.
+  unique_ptr<TreeInput> input(yamlpath ? new CategorizedTreeInput("Events", yamlpath) : new TreeInput("Events"));
+  for(const string &branch : branches) input->add_branch(branch.c_str());
+  for(int i = 2; i < argc; ++i) {
+    ListDir lsrst(argv[i], ListDir::DT_ALL & ~ListDir::DT_DIR);
+    lsrst.sort_by_numbers();
+    for(const string &name : lsrst.get_full_names()) input->add_filename(name.c_str());
+  }
+
+  SkimOutput output(input.get(), argv[1]);
+  while(input->next()) output.process();
+  return output.flush() ? 0 : 1;
+}
@@ -1,9 +1,12 @@
 #include "CategorizedTreeInput.h"
+#include "Hasher.h"
 #include "fs.h"
 #include <yaml-cpp/yaml.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 #include <string>
+#include <vector>
 #include <unordered_map>
 #include <utility>
 #include <iostream>
@@ -14,68 +17,134 @@ using namespace std;
 
 class CategorizedTreeInput::Detail {
 public:
+  struct Sample {
+    string name;
+    size_t id;
+    double xs;
+    double nevent_total;
+    vector<double> fields;
+    size_t nevent;
+    vector<size_t> files;  // planned
+  };
+  struct Category {
+    string name;
+    size_t id;
+    bool issignal;
+    vector<Sample> samples;
+    size_t nevent;
+  };
+
   YAML::Node yaml;
-  unordered_map<string, YAML::Node> category_index;
-  unordered_map<string, pair<YAML::Node, YAML::Node /* category */>> sample_index;
-  size_t sample_name_minlen;
-  size_t sample_name_maxlen;
-  YAML::Node *current_category;
-  YAML::Node *current_sample;
+  vector<Category> categories;
+  unordered_map<string, size_t> category_index;
+  unordered_map<string, pair<size_t, size_t>> sample_index;
+  vector<string> field_names;
+  Category *current_category;
+  Sample *current_sample;
+
+  // Prefix trie over sample names, with trie[0] as root.
+  struct TrieNode {
+    vector<pair<char, size_t>> children;  // sorted by character
+    size_t icategory, isample;  // -1 if no sample name ends here
+  };
+  vector<TrieNode> trie;
+
+  // File index -> (icategory, isample), filled by plan().
+  vector<pair<size_t, size_t>> file_samples;
+  bool planned;
+
+  void trie_insert(const string &name, size_t icategory, size_t isample) {
+    size_t inode = 0;
+    for(char c : name) {
+      vector<pair<char, size_t>> &children = trie[inode].children;
+      auto iter = lower_bound(children.begin(), children.end(), make_pair(c, (size_t)0));
+      if(iter == children.end() || iter->first != c) {
+        iter = children.insert(iter, { c, trie.size() });
+        trie.push_back({ { }, (size_t)-1, (size_t)-1 });
+      }
+      inode = iter->second;
+    }
+    trie[inode].icategory = icategory;
+    trie[inode].isample = isample;
+  }
+
+  // Find the longest sample name prefixing the basename of path.
+  bool trie_match(const char *path, size_t &icategory, size_t &isample) const {
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    icategory = isample = -1;
+    size_t inode = 0;
+    for(;;) {
+      if(trie[inode].isample != (size_t)-1) {
+        icategory = trie[inode].icategory;
+        isample = trie[inode].isample;
+      }
+      if(*name == 0) break;
+      const vector<pair<char, size_t>> &children = trie[inode].children;
+      char c = *name++;
+      auto iter = lower_bound(children.begin(), children.end(), make_pair(c, (size_t)0));
+      if(iter == children.end() || iter->first != c) break;
+      inode = iter->second;
+    }
+    return isample != (size_t)-1;
+  }
+
+  void set_current(size_t icategory, size_t isample) {
+    current_category = &categories[icategory];
+    current_sample = &current_category->samples[isample];
+  }
+
+  static double get_number(const YAML::Node &node) {
+    if(!node || !node.IsScalar()) return NAN;
+    try { return node.as<double>(); } catch(const YAML::Exception &) { return NAN; }
+  }
 
   void load_samples(const char *yamlpath) {
     yaml = YAML::LoadFile(yamlpath);
+    trie.push_back({ { }, (size_t)-1, (size_t)-1 });
 
     // Index categories.
-    size_t icategory = 0;
-    for(YAML::Node category : yaml) {
-      const string &category_name = category["name"].as<string>();
-      if(!category_index.insert({ category_name, category }).second) {
-        throw logic_error("duplicate category name: " + category_name);
+    for(const YAML::Node &category_node : yaml) {
+      Category category;
+      category.name = category_node["name"].as<string>();
+      category.id = categories.size();
+      category.issignal = category_node["is_signal"] && category_node["is_signal"].as<bool>();
+      category.nevent = 0;
+      if(!category_index.insert({ category.name, category.id }).second) {
+        throw logic_error("duplicate category name: " + category.name);
       }
 
       // Index samples.
-      size_t isample = 0;
-      for(YAML::Node sample : category["samples"]) {
-        const string &sample_name = sample["name"].as<string>();
-        if(!sample_index.insert({ sample_name, { sample, category } }).second) {
-          throw logic_error("duplicate sample name: " + sample_name);
+      for(const YAML::Node &sample_node : category_node["samples"]) {
+        Sample sample;
+        sample.name = sample_node["name"].as<string>();
+        sample.id = category.samples.size();
+        sample.xs = get_number(sample_node["xs"]);
+        sample.nevent_total = get_number(sample_node["nevent"]);
+        sample.nevent = 0;
+        if(!sample_index.insert({ sample.name, { category.id, sample.id } }).second) {
+          throw logic_error("duplicate sample name: " + sample.name);
         }
-
-        sample_name_minlen = min(sample_name_minlen, sample_name.length());
-        sample_name_maxlen = max(sample_name_maxlen, sample_name.length());
-        sample["_runtime_id"] = isample++;
-        sample["_runtime_nevent"] = 0;
+        trie_insert(sample.name, category.id, sample.id);
+        category.samples.push_back(std::move(sample));
       }
-      category["_runtime_id"] = icategory++;
-      category["_runtime_nevent"] = 0;
+      categories.push_back(std::move(category));
     }
   }
 
   void list_samples() const {
-    for(const YAML::Node &category : yaml) {
-      cout << "- " << category["name"] << endl;
-      for(const YAML::Node &sample : category["samples"]) {
-        cout << "  + " << sample["name"] << endl;
+    for(const Category &category : categories) {
+      cout << "- " << category.name << endl;
+      for(const Sample &sample : category.samples) {
+        cout << "  + " << sample.name << endl;
       }
     }
   }
 
-  bool match_filename(const char *filename_in) {
-    string filename = basename(filename_in);
-    size_t minlen = sample_name_minlen;
-    size_t maxlen = min(sample_name_maxlen, filename.length());
-    if(maxlen < minlen) return false;
-    for(;;) {
-      auto sample_iter = sample_index.find(filename.substr(0, maxlen));
-      if(sample_iter != sample_index.end()) {
-        current_sample = &sample_iter->second.first;
-        current_category = &sample_iter->second.second;
-        return true;
-      }
-      if(maxlen == minlen) break;
-      --maxlen;
-    }
-    return false;
+  const Sample *get_sample(size_t icategory, size_t isample) const {
+    if(icategory >= categories.size()) return nullptr;
+    if(isample >= categories[icategory].samples.size()) return nullptr;
+    return &categories[icategory].samples[isample];
   }
 };
 
@@ -83,12 +152,10 @@ CategorizedTreeInput::CategorizedTreeInput(const char *name, const char *yamlpat
   : TreeInput(name), yamlpath_(strdup(yamlpath))
 {
   detail_ = new Detail;
-  detail_->sample_name_minlen = -1;
-  detail_->sample_name_maxlen = 0;
+  detail_->planned = false;
   detail_->current_category = nullptr;
   detail_->current_sample = nullptr;
   detail_->load_samples(yamlpath_);
-  detail_->list_samples();
 }
 
 CategorizedTreeInput::~CategorizedTreeInput()
@@ -97,9 +164,31 @@ CategorizedTreeInput::~CategorizedTreeInput()
   free(yamlpath_);
 }
 
+void CategorizedTreeInput::list_samples() const
+{
+  detail_->list_samples();
+}
+
 bool CategorizedTreeInput::on_new_file(const char *filename)
 {
-  return detail_->match_filename(filename);
+  size_t icategory, isample;
+  size_t ifilename = get_ifilename();
+  if(detail_->planned && ifilename < detail_->file_samples.size()) {
+    icategory = detail_->file_samples[ifilename].first;
+    isample = detail_->file_samples[ifilename].second;
+    if(isample == (size_t)-1) return false;
+  } else if(!detail_->trie_match(filename, icategory, isample)) {
+    return false;
+  }
+  detail_->set_current(icategory, isample);
+  return true;
+}
+
+bool CategorizedTreeInput::want_file(size_t ifilename, const char *filename) const
+{
+  size_t icategory, isample;
+  if(detail_->planned && ifilename < detail_->file_samples.size()) return detail_->file_samples[ifilename].second != (size_t)-1;
+  return detail_->trie_match(filename, icategory, isample);
 }
 
 void CategorizedTreeInput::on_open_file()
@@ -109,22 +198,91 @@ void CategorizedTreeInput::on_open_file()
 
 void CategorizedTreeInput::on_close_file()
 {
-  size_t nevent = get_local_index();
-  (*detail_->current_category)["_runtime_nevent"] =
-    (*detail_->current_category)["_runtime_nevent"].as<size_t>() + nevent;
-  (*detail_->current_sample)["_runtime_nevent"] =
-    (*detail_->current_sample)["_runtime_nevent"].as<size_t>() + nevent;
+  size_t nevent = get_local_index() - get_entry_begin();
+  detail_->current_category->nevent += nevent;
+  detail_->current_sample->nevent += nevent;
+}
+
+void CategorizedTreeInput::merge(const TreeInput &other_in)
+{
+  TreeInput::merge(other_in);
+  auto other = dynamic_cast<const CategorizedTreeInput *>(&other_in);
+  if(!other) return;
+  size_t ncategory = min(get_ncategory(), other->get_ncategory());
+  for(size_t i = 0; i < ncategory; ++i) {
+    detail_->categories[i].nevent += other->get_category_nevent(i);
+    size_t nsample = min(get_nsample(i), other->get_nsample(i));
+    for(size_t j = 0; j < nsample; ++j) {
+      detail_->categories[i].samples[j].nevent += other->get_sample_nevent(i, j);
+    }
+  }
+}
+
+void CategorizedTreeInput::hash_inputs(Hasher &hasher) const
+{
+  TreeInput::hash_inputs(hasher);
+  if(!hasher.update_file(yamlpath_)) hasher.update(yamlpath_);
+  for(const Detail::Category &category : detail_->categories) hasher.update((uint64_t)category.issignal);
+  for(const string &field_name : detail_->field_names) hasher.update(field_name);
+}
+
+size_t CategorizedTreeInput::plan()
+{
+  for(Detail::Category &category : detail_->categories) {
+    for(Detail::Sample &sample : category.samples) sample.files.clear();
+  }
+
+  size_t nfilename = get_nfilename();
+  size_t nmatched = 0;
+  detail_->file_samples.resize(nfilename);
+  for(size_t i = 0; i < nfilename; ++i) {
+    size_t icategory, isample;
+    if(detail_->trie_match(get_filename(i), icategory, isample)) {
+      detail_->categories[icategory].samples[isample].files.push_back(i);
+      ++nmatched;
+    } else {
+      cerr << "Warning: no sample matching file: " << get_filename(i) << endl;
+    }
+    detail_->file_samples[i] = { icategory, isample };
+  }
+  detail_->planned = true;
+
+  size_t nsample = 0;
+  for(const Detail::Category &category : detail_->categories) {
+    for(const Detail::Sample &sample : category.samples) nsample += !sample.files.empty();
+  }
+  clog << "Info: planned " << nmatched << "/" << nfilename << " files for "
+       << nsample << " samples" << endl;
+  return nmatched;
+}
+
+size_t CategorizedTreeInput::get_file_icategory(size_t ifilename) const
+{
+  if(ifilename >= detail_->file_samples.size()) return -1;
+  return detail_->file_samples[ifilename].first;
+}
+
+size_t CategorizedTreeInput::get_file_isample(size_t ifilename) const
+{
+  if(ifilename >= detail_->file_samples.size()) return -1;
+  return detail_->file_samples[ifilename].second;
+}
+
+vector<size_t> CategorizedTreeInput::get_sample_files(size_t icategory, size_t isample) const
+{
+  const Detail::Sample *sample = detail_->get_sample(icategory, isample);
+  return sample ? sample->files : vector<size_t>();
 }
 
 size_t CategorizedTreeInput::get_ncategory() const
 {
-  return detail_->yaml.size();
+  return detail_->categories.size();
 }
 
 string CategorizedTreeInput::get_category(size_t i) const
 {
-  if(i >= detail_->yaml.size()) return "";
-  return detail_->yaml[i]["name"].as<string>();
+  if(i >= detail_->categories.size()) return "";
+  return detail_->categories[i].name;
 }
 
 bool CategorizedTreeInput::get_category_configuration(size_t i, YAML::Node *node) const
@@ -138,21 +296,19 @@ bool CategorizedTreeInput::get_category_configuration(const string &category, YA
 {
   auto iter = detail_->category_index.find(category);
   if(iter == detail_->category_index.end()) return false;
-  if(node) *node = iter->second;
-  return true;
+  return get_category_configuration(iter->second, node);
 }
 
 size_t CategorizedTreeInput::get_nsample(size_t i) const
 {
-  if(i >= detail_->yaml.size()) return 0;
-  return detail_->yaml[i]["samples"].size();
+  if(i >= detail_->categories.size()) return 0;
+  return detail_->categories[i].samples.size();
 }
 
 string CategorizedTreeInput::get_sample(size_t icategory, size_t isample) const
 {
-  if(icategory >= detail_->yaml.size()) return "";
-  if(isample >= detail_->yaml[icategory]["samples"].size()) return "";
-  return detail_->yaml[icategory]["samples"][isample]["name"].as<string>();
+  const Detail::Sample *sample = detail_->get_sample(icategory, isample);
+  return sample ? sample->name : "";
 }
 
 bool CategorizedTreeInput::get_sample_configuration(size_t icategory, size_t isample,
@@ -171,75 +327,146 @@ bool CategorizedTreeInput::get_sample_configuration(const string &sample,
 {
   auto iter = detail_->sample_index.find(sample);
   if(iter == detail_->sample_index.end()) return false;
-  if(sample_node) *sample_node = iter->second.first;
-  if(category_node) *category_node = iter->second.second;
-  return true;
+  return get_sample_configuration(iter->second.first, iter->second.second, sample_node, category_node);
+}
+
+bool CategorizedTreeInput::get_category_issignal(size_t i) const
+{
+  if(i >= detail_->categories.size()) return false;
+  return detail_->categories[i].issignal;
+}
+
+void CategorizedTreeInput::set_category_issignal(size_t i, bool issignal)
+{
+  if(i >= detail_->categories.size()) return;
+  detail_->categories[i].issignal = issignal;
+}
+
+double CategorizedTreeInput::get_sample_xs(size_t icategory, size_t isample) const
+{
+  const Detail::Sample *sample = detail_->get_sample(icategory, isample);
+  return sample ? sample->xs : NAN;
+}
+
+double CategorizedTreeInput::get_sample_nevent_total(size_t icategory, size_t isample) const
+{
+  const Detail::Sample *sample = detail_->get_sample(icategory, isample);
+  return sample ? sample->nevent_total : NAN;
+}
+
+size_t CategorizedTreeInput::add_sample_field(const char *key)
+{
+  size_t ifield = detail_->field_names.size();
+  detail_->field_names.push_back(key);
+  for(size_t i = 0; i < detail_->categories.size(); ++i) {
+    Detail::Category &category = detail_->categories[i];
+    for(size_t j = 0; j < category.samples.size(); ++j) {
+      YAML::Node node;
+      get_sample_configuration(i, j, &node);
+      category.samples[j].fields.push_back(Detail::get_number(node[key]));
+    }
+  }
+  return ifield;
+}
+
+double CategorizedTreeInput::get_sample_field(size_t icategory, size_t isample, size_t ifield) const
+{
+  const Detail::Sample *sample = detail_->get_sample(icategory, isample);
+  if(!sample || ifield >= sample->fields.size()) return NAN;
+  return sample->fields[ifield];
 }
 
 string CategorizedTreeInput::get_category() const
 {
-  YAML::Node *node = detail_->current_category;
-  if(!node) return "";
-  return (*node)["name"].as<string>();
+  Detail::Category *category = detail_->current_category;
+  return category ? category->name : "";
 }
 
 string CategorizedTreeInput::get_sample() const
 {
-  YAML::Node *node = detail_->current_sample;
-  if(!node) return "";
-  return (*node)["name"].as<string>();
+  Detail::Sample *sample = detail_->current_sample;
+  return sample ? sample->name : "";
 }
 
 size_t CategorizedTreeInput::get_icategory() const
 {
-  YAML::Node *category = detail_->current_category;
-  return category ? (*category)["_runtime_id"].as<size_t>() : -1;
+  Detail::Category *category = detail_->current_category;
+  return category ? category->id : -1;
 }
 
 size_t CategorizedTreeInput::get_isample() const
 {
-  YAML::Node *sample = detail_->current_sample;
-  return sample ? (*sample)["_runtime_id"].as<size_t>() : -1;
+  Detail::Sample *sample = detail_->current_sample;
+  return sample ? sample->id : -1;
 }
 
 bool CategorizedTreeInput::get_category_configuration(YAML::Node *node) const
 {
   if(!detail_->current_category) return false;
-  if(node) *node = *detail_->current_category;
-  return true;
+  return get_category_configuration(get_icategory(), node);
 }
 
 bool CategorizedTreeInput::get_sample_configuration(YAML::Node *node) const
 {
   if(!detail_->current_sample) return false;
-  if(node) *node = *detail_->current_sample;
-  return true;
+  return get_sample_configuration(get_icategory(), get_isample(), node);
+}
+
+bool CategorizedTreeInput::get_category_issignal() const
+{
+  Detail::Category *category = detail_->current_category;
+  return category ? category->issignal : false;
+}
+
+double CategorizedTreeInput::get_sample_xs() const
+{
+  Detail::Sample *sample = detail_->current_sample;
+  return sample ? sample->xs : NAN;
+}
+
+double CategorizedTreeInput::get_sample_nevent_total() const
+{
+  Detail::Sample *sample = detail_->current_sample;
+  return sample ? sample->nevent_total : NAN;
+}
+
+double CategorizedTreeInput::get_sample_field(size_t ifield) const
+{
+  Detail::Sample *sample = detail_->current_sample;
+  if(!sample || ifield >= sample->fields.size()) return NAN;
+  return sample->fields[ifield];
 }
 
 size_t CategorizedTreeInput::get_category_nevent(const string &category) const
 {
-  YAML::Node configuration;
-  if(!get_category_configuration(category, &configuration)) return 0;
-  return configuration["_runtime_nevent"].as<size_t>();
+  auto iter = detail_->category_index.find(category);
+  if(iter == detail_->category_index.end()) return 0;
+  return get_category_nevent(iter->second);
 }
 
 size_t CategorizedTreeInput::get_sample_nevent(const string &sample) const
 {
-  YAML::Node configuration;
-  if(!get_sample_configuration(sample, &configuration)) return 0;
-  return configuration["_runtime_nevent"].as<size_t>();
+  auto iter = detail_->sample_index.find(sample);
+  if(iter == detail_->sample_index.end()) return 0;
+  return get_sample_nevent(iter->second.first, iter->second.second);
 }
 
 size_t CategorizedTreeInput::get_category_nevent(size_t icategory) const
 {
-  YAML::Node configuration;
-  if(!get_category_configuration(icategory, &configuration)) return 0;
-  return configuration["_runtime_nevent"].as<size_t>();
+  if(icategory >= detail_->categories.size()) return 0;
+  return detail_->categories[icategory].nevent;
 }
 
 size_t CategorizedTreeInput::get_sample_nevent(size_t icategory, size_t isample) const
 {
-  YAML::Node configuration;
-  if(!get_sample_configuration(icategory, isample, &configuration)) return 0;
-  return configuration["_runtime_nevent"].as<size_t>();
+  const Detail::Sample *sample = detail_->get_sample(icategory, isample);
+  return sample ? sample->nevent : 0;
+}
+
+void CategorizedTreeInput::add_sample_nevent(size_t icategory, size_t isample, size_t nevent)
+{
+  const Detail::Sample *sample = detail_->get_sample(icategory, isample);
+  if(!sample) return;
+  const_cast<Detail::Sample *>(sample)->nevent += nevent;
+  detail_->categories[icategory].nevent += nevent;
 }
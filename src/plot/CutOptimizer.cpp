@@ -0,0 +1,215 @@
+#include "CutOptimizer.h"
+#include "HistOutput.h"
+#include "CutScan.h"
+#include <TH1.h>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+
+using namespace std;
+
+class CutOptimizer::Detail {
+public:
+  // Yields per curve and cell (x, y, z), already summed over x' >= x and
+  // y' >= y, so that a working point is a sum over a z window.
+  size_t ncell[3];
+  vector<double> edges[3];  // cut value of each cell, one more for z
+  vector<vector<double>> sumw, sumw2;
+  vector<bool> issignal;
+  double scale;
+  size_t ndim;
+
+  size_t index(size_t bx, size_t by, size_t bz) const { return (bx * ncell[1] + by) * ncell[2] + bz; }
+
+  void resize(size_t ncurve) {
+    size_t n = ncell[0] * ncell[1] * ncell[2];
+    sumw.assign(ncurve, vector<double>(n, 0.0));
+    sumw2.assign(ncurve, vector<double>(n, 0.0));
+    issignal.assign(ncurve, false);
+  }
+};
+
+static bool point_less(const CutOptimizer::Point &a, const CutOptimizer::Point &b)
+{
+  return a.significance > b.significance;  // min-heap on top
+}
+
+CutOptimizer::CutOptimizer(const HistOutput &hist)
+  : metric_(ASIMOV), rel_syst_(0.0), min_background_(0.0), nthread_(0)
+{
+  detail_ = new Detail;
+  detail_->scale = 1.0;
+  detail_->ndim = 1;
+  size_t nbin = hist.is_binned() ? hist.get_nbin() : 0;
+  if(nbin == 0) cerr << "Warning: optimizing cuts on unbinned output: " << hist.get_filename() << endl;
+
+  // Cuts at no cut and at low edges of bins 1 to nbin; y and z are not cut.
+  detail_->ncell[0] = nbin + 1;
+  detail_->ncell[1] = 1;
+  detail_->ncell[2] = 1;
+  detail_->edges[0].push_back(-INFINITY);
+  for(size_t b = 1; b <= nbin; ++b) detail_->edges[0].push_back(hist.get_curve(0)->GetBinLowEdge(b));
+  detail_->edges[1] = { -INFINITY };
+  detail_->edges[2] = { -INFINITY, INFINITY };
+  detail_->resize(nbin ? hist.get_ncurve() : 0);
+  for(size_t i = 0; i < detail_->sumw.size(); ++i) {
+    detail_->issignal[i] = hist.curve_issignal(i);
+    const TH1 *curve = hist.get_curve(i);
+    // In-range bins only, as drawn: no cut is the same as a cut at bin 1.
+    double w = 0.0, w2 = 0.0;
+    for(size_t b = nbin; b > 0; --b) {
+      w += curve->GetBinContent(b);
+      w2 += pow(curve->GetBinError(b), 2);
+      detail_->sumw[i][b] = w, detail_->sumw2[i][b] = w2;
+    }
+    detail_->sumw[i][0] = w, detail_->sumw2[i][0] = w2;
+  }
+}
+
+CutOptimizer::CutOptimizer(const CutScan &scan)
+  : metric_(ASIMOV), rel_syst_(0.0), min_background_(0.0), nthread_(0)
+{
+  detail_ = new Detail;
+  detail_->scale = 1.0;
+  detail_->ndim = 3;
+
+  // Cuts on x and y at no cut and at low edges of bins; z cells are all bins.
+  for(int axis = 0; axis < 3; ++axis) {
+    size_t nbin = scan.get_nbin(axis);
+    detail_->ncell[axis] = axis < 2 ? nbin + 1 : nbin + 2;
+    for(size_t b = 0; b <= nbin + 1; ++b) detail_->edges[axis].push_back(scan.get_bin_edge(axis, b));
+    if(axis == 2) detail_->edges[axis].push_back(INFINITY);
+    else detail_->edges[axis].pop_back();
+  }
+  detail_->resize(scan.get_ncurve());
+  for(size_t i = 0; i < scan.get_ncurve(); ++i) {
+    detail_->issignal[i] = scan.curve_issignal(i);
+    for(size_t bx = 0; bx < detail_->ncell[0]; ++bx) {
+      for(size_t by = 0; by < detail_->ncell[1]; ++by) {
+        // Query at bin centers to avoid rounding at edges.
+        double x = bx ? 0.5 * (scan.get_bin_edge(0, bx) + scan.get_bin_edge(0, bx + 1)) : -INFINITY;
+        double y = by ? 0.5 * (scan.get_bin_edge(1, by) + scan.get_bin_edge(1, by + 1)) : -INFINITY;
+        vector<double> w2;
+        vector<double> w = scan.project_z(i, x, y, &w2);
+        copy(w.begin(), w.end(), &detail_->sumw[i][detail_->index(bx, by, 0)]);
+        copy(w2.begin(), w2.end(), &detail_->sumw2[i][detail_->index(bx, by, 0)]);
+      }
+    }
+  }
+}
+
+CutOptimizer::~CutOptimizer()
+{
+  delete detail_;
+}
+
+size_t CutOptimizer::get_ndim() const
+{
+  return detail_->ndim;
+}
+
+void CutOptimizer::set_signal(size_t icurve, bool sg)
+{
+  if(icurve < detail_->issignal.size()) detail_->issignal[icurve] = sg;
+}
+
+void CutOptimizer::set_scale(double scale)
+{
+  detail_->scale = scale;
+}
+
+double CutOptimizer::get_significance(double s, double b, double b_error) const
+{
+  if(metric_ == S_OVER_SQRT_B) return s / sqrt(b);
+  double v = b_error * b_error;
+  if(metric_ == ASIMOV || v == 0.0) return sqrt(2 * ((s + b) * log(1 + s / b) - s));
+  double z2 = (s + b) * log((s + b) * (b + v) / (b * b + (s + b) * v)) - b * b / v * log(1 + v * s / (b * (b + v)));
+  return sqrt(2 * z2);
+}
+
+vector<CutOptimizer::Point> CutOptimizer::optimize(size_t topk) const
+{
+  const Detail &d = *detail_;
+  size_t nx = d.ncell[0], ny = d.ncell[1], nz = d.ncell[2];
+  if(topk == 0 || nx == 0 || d.sumw.empty()) return { };
+
+  // Prefix sums over z of signal, background and its squared error,
+  // so that each working point costs O(1).
+  size_t nzp = nz + 1;
+  vector<double> ps(nx * ny * nzp, 0.0), pb(nx * ny * nzp, 0.0), pb2(nx * ny * nzp, 0.0);
+  double scale = d.scale, scale2 = d.scale * d.scale;
+  for(size_t bx = 0; bx < nx; ++bx) {
+    for(size_t by = 0; by < ny; ++by) {
+      size_t k0 = (bx * ny + by) * nzp;
+      for(size_t bz = 0; bz < nz; ++bz) {
+        double s = 0.0, b = 0.0, b2 = 0.0;
+        for(size_t i = 0; i < d.sumw.size(); ++i) {
+          if(d.issignal[i]) s += d.sumw[i][d.index(bx, by, bz)];
+          else b += d.sumw[i][d.index(bx, by, bz)], b2 += d.sumw2[i][d.index(bx, by, bz)];
+        }
+        ps[k0 + bz + 1] = ps[k0 + bz] + s * scale;
+        pb[k0 + bz + 1] = pb[k0 + bz] + b * scale;
+        pb2[k0 + bz + 1] = pb2[k0 + bz] + b2 * scale2;
+      }
+    }
+  }
+
+  // Windows in z span bins 1 to nz, or the single cell of an uncut z.
+  size_t zfirst = nz > 1 ? 1 : 0, zlast = nz > 1 ? nz - 2 : 0;
+
+  // Rows (x, y) are handed out to threads, each keeping its own top-k heap.
+  size_t nthread = nthread_ ? nthread_ : thread::hardware_concurrency();
+  nthread = max<size_t>(1, min(nthread, nx * ny));
+  vector<vector<Point>> heaps(nthread);
+  atomic<size_t> cursor(0);
+  auto work = [&](vector<Point> &heap) {
+    for(size_t row; (row = cursor++) < nx * ny;) {
+      size_t bx = row / ny, by = row % ny, k0 = row * nzp;
+      for(size_t bl = zfirst; bl <= zlast; ++bl) {
+        for(size_t bh = bl; bh <= zlast; ++bh) {
+          double s = ps[k0 + bh + 1] - ps[k0 + bl];
+          double b = pb[k0 + bh + 1] - pb[k0 + bl];
+          if(!(b > min_background_)) continue;
+          double b2 = pb2[k0 + bh + 1] - pb2[k0 + bl];
+          double b_error = sqrt(max(b2, 0.0) + pow(rel_syst_ * b, 2));
+          double sig = get_significance(s, b, b_error);
+          if(!isfinite(sig)) continue;
+          if(heap.size() == topk && sig <= heap.front().significance) continue;
+          heap.push_back({ sig, d.edges[0][bx], d.edges[1][by], d.edges[2][bl], d.edges[2][bh + 1], s, b, b_error });
+          push_heap(heap.begin(), heap.end(), point_less);
+          if(heap.size() > topk) pop_heap(heap.begin(), heap.end(), point_less), heap.pop_back();
+        }
+      }
+    }
+  };
+  vector<thread> threads;
+  for(size_t t = 1; t < nthread; ++t) threads.emplace_back(work, ref(heaps[t]));
+  work(heaps[0]);
+  for(thread &t : threads) t.join();
+
+  // Only the k best of each thread are sorted.
+  vector<Point> points;
+  for(const auto &heap : heaps) points.insert(points.end(), heap.begin(), heap.end());
+  size_t n = min(topk, points.size());
+  partial_sort(points.begin(), points.begin() + n, points.end(), point_less);
+  points.resize(n);
+  return points;
+}
+
+void CutOptimizer::print(const vector<Point> &points) const
+{
+  if(detail_->ndim == 1) cout << "sig.\tpos.\tsg.\tbg.\tbg. err." << endl;
+  else cout << "sig.\tx cut\ty cut\tz low\tz high\tsg.\tbg.\tbg. err." << endl;
+  cout << scientific << setprecision(1);
+  for(const Point &p : points) {
+    cout << p.significance << '\t' << p.xcut << '\t';
+    if(detail_->ndim > 1) cout << p.ycut << '\t' << p.zlow << '\t' << p.zhigh << '\t';
+    cout << p.s << '\t' << p.b << '\t' << p.b_error << endl;
+  }
+  cout << defaultfloat;
+}
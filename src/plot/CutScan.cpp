@@ -0,0 +1,297 @@
+#include "CutScan.h"
+#include "fs.h"
+#include <TH3.h>
+#include <TAxis.h>
+#include <TFile.h>
+#include <TObjString.h>
+#include <yaml-cpp/yaml.h>
+#include <vector>
+#include <memory>
+#include <string>
+#include <iostream>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+using namespace std;
+
+class CutScan::Detail {
+public:
+  size_t nbin[3];
+  double lb[3], ub[3];
+  vector<unique_ptr<TH3>> curves;
+  vector<string> curve_titles;
+  vector<bool> curve_issignal;
+
+  // Sums over x' >= x and y' >= y per (x, y, z) cell, built on first readout
+  // and dropped on filling, so that any pair of cuts is read out in O(nz).
+  vector<vector<double>> cumw, cumw2;
+
+  size_t ncell(int axis) const { return nbin[axis] + 2; }
+  size_t index(size_t bx, size_t by, size_t bz) const { return (bx * ncell(1) + by) * ncell(2) + bz; }
+
+  void invalidate(size_t i) {
+    if(i < cumw.size()) cumw[i].clear(), cumw2[i].clear();
+  }
+
+  void accumulate(size_t i) {
+    cumw.resize(curves.size());
+    cumw2.resize(curves.size());
+    if(!cumw[i].empty()) return;
+    size_t nx = ncell(0), ny = ncell(1), nz = ncell(2);
+    vector<double> &w = cumw[i], &w2 = cumw2[i];
+    w.assign(nx * ny * nz, 0.0);
+    w2.assign(nx * ny * nz, 0.0);
+    const TH3 *curve = curves[i].get();
+    for(size_t bx = nx; bx-- > 0;) {
+      for(size_t by = ny; by-- > 0;) {
+        for(size_t bz = 0; bz < nz; ++bz) {
+          size_t k = index(bx, by, bz);
+          double e = curve->GetBinError(curve->GetBin(bx, by, bz));
+          w[k] = curve->GetBinContent(curve->GetBin(bx, by, bz));
+          w2[k] = e * e;
+          if(bx + 1 < nx) w[k] += w[index(bx + 1, by, bz)], w2[k] += w2[index(bx + 1, by, bz)];
+          if(by + 1 < ny) w[k] += w[index(bx, by + 1, bz)], w2[k] += w2[index(bx, by + 1, bz)];
+          if(bx + 1 < nx && by + 1 < ny) {
+            w[k] -= w[index(bx + 1, by + 1, bz)];
+            w2[k] -= w2[index(bx + 1, by + 1, bz)];
+          }
+        }
+      }
+    }
+  }
+
+  TH3 *make_curve(size_t i) const {
+    string name = "cutscan_" + to_string((size_t)this) + "_" + to_string(i);
+    TH3 *curve = new TH3D(name.c_str(), curve_titles[i].c_str(),
+        nbin[0], lb[0], ub[0], nbin[1], lb[1], ub[1], nbin[2], lb[2], ub[2]);
+    curve->SetDirectory(nullptr);
+    curve->Sumw2();
+    return curve;
+  }
+};
+
+CutScan::CutScan(const char *filename, size_t nx, double xlb, double xub,
+    size_t ny, double ylb, double yub, size_t nz, double zlb, double zub)
+  : filename_(filename ? strdup(filename) : nullptr)
+{
+  detail_ = new Detail;
+  detail_->nbin[0] = nx, detail_->lb[0] = xlb, detail_->ub[0] = xub;
+  detail_->nbin[1] = ny, detail_->lb[1] = ylb, detail_->ub[1] = yub;
+  detail_->nbin[2] = nz, detail_->lb[2] = zlb, detail_->ub[2] = zub;
+}
+
+CutScan::~CutScan()
+{
+  if(filename_ && !save()) cerr << "Warning: failed to save scan: " << filename_ << endl;
+  delete detail_;
+  free(filename_);
+}
+
+void CutScan::set_filename(const char *filename)
+{
+  free(filename_);
+  filename_ = filename ? strdup(filename) : nullptr;
+}
+
+size_t CutScan::add_curve(const char *title, bool sg)
+{
+  size_t i = detail_->curves.size();
+  detail_->curve_titles.emplace_back(title);
+  detail_->curve_issignal.push_back(sg);
+  detail_->curves.emplace_back(detail_->make_curve(i));
+  return i;
+}
+
+size_t CutScan::get_ncurve() const
+{
+  return detail_->curves.size();
+}
+
+TH3 *CutScan::get_curve(size_t i) const
+{
+  return i < get_ncurve() ? detail_->curves[i].get() : nullptr;
+}
+
+const char *CutScan::get_curve_title(size_t i) const
+{
+  return i < get_ncurve() ? detail_->curve_titles[i].c_str() : nullptr;
+}
+
+bool CutScan::curve_issignal(size_t i) const
+{
+  return i < get_ncurve() ? detail_->curve_issignal[i] : false;
+}
+
+bool CutScan::fill_curve(size_t i, double x, double y, double z, double weight) const
+{
+  if(i >= get_ncurve()) return false;
+  detail_->invalidate(i);
+  detail_->curves[i]->Fill(x, y, z, weight);
+  return true;
+}
+
+size_t CutScan::get_nbin(int axis) const
+{
+  return detail_->nbin[axis];
+}
+
+double CutScan::get_bin_edge(int axis, size_t ibin) const
+{
+  if(ibin == 0) return -INFINITY;  // underflow
+  return detail_->lb[axis] + (detail_->ub[axis] - detail_->lb[axis]) * (ibin - 1.0) / detail_->nbin[axis];
+}
+
+size_t CutScan::find_bin(int axis, double value) const
+{
+  double lb = detail_->lb[axis], ub = detail_->ub[axis];
+  size_t nbin = detail_->nbin[axis];
+  if(!(value >= lb)) return 0;
+  if(value >= ub) return nbin + 1;
+  return min((size_t)((value - lb) / (ub - lb) * nbin), nbin - 1) + 1;
+}
+
+vector<double> CutScan::project_z(size_t i, double xcut, double ycut, vector<double> *sumw2) const
+{
+  if(i >= get_ncurve()) return { };
+  detail_->accumulate(i);
+  size_t bx = find_bin(0, xcut), by = find_bin(1, ycut), nz = detail_->ncell(2);
+  const double *w = &detail_->cumw[i][detail_->index(bx, by, 0)];
+  const double *w2 = &detail_->cumw2[i][detail_->index(bx, by, 0)];
+  if(sumw2) sumw2->assign(w2, w2 + nz);
+  return vector<double>(w, w + nz);
+}
+
+double CutScan::get_yield(size_t i, double xcut, double ycut, double zlow, double zhigh, double *sumw2) const
+{
+  vector<double> w2;
+  vector<double> w = project_z(i, xcut, ycut, &w2);
+  double yield = 0.0, yield2 = 0.0;
+  if(!w.empty()) {
+    size_t bzl = find_bin(2, zlow), bzh = find_bin(2, zhigh);
+    if(bzh && get_bin_edge(2, bzh) == zhigh) --bzh;  // [zlow, zhigh)
+    for(size_t bz = bzl; bz <= bzh && bz < w.size(); ++bz) yield += w[bz], yield2 += w2[bz];
+  }
+  if(sumw2) *sumw2 = yield2;
+  return yield;
+}
+
+vector<double> CutScan::project_y(size_t i, double xcut, vector<double> *sumw2) const
+{
+  if(i >= get_ncurve()) return { };
+  detail_->accumulate(i);
+  size_t bx = find_bin(0, xcut), ny = detail_->ncell(1), nz = detail_->ncell(2);
+  const vector<double> &cw = detail_->cumw[i], &cw2 = detail_->cumw2[i];
+  vector<double> w(ny), w2(ny);
+  for(size_t by = 0; by < ny; ++by) {
+    for(size_t bz = 0; bz < nz; ++bz) {
+      w[by] += cw[detail_->index(bx, by, bz)];
+      w2[by] += cw2[detail_->index(bx, by, bz)];
+      if(by + 1 < ny) {
+        w[by] -= cw[detail_->index(bx, by + 1, bz)];
+        w2[by] -= cw2[detail_->index(bx, by + 1, bz)];
+      }
+    }
+  }
+  if(sumw2) *sumw2 = std::move(w2);
+  return w;
+}
+
+bool CutScan::merge(const CutScan &other)
+{
+  if(other.get_ncurve() != get_ncurve()) return false;
+  for(int axis = 0; axis < 3; ++axis) {
+    if(other.detail_->nbin[axis] != detail_->nbin[axis]) return false;
+    if(other.detail_->lb[axis] != detail_->lb[axis]) return false;
+    if(other.detail_->ub[axis] != detail_->ub[axis]) return false;
+  }
+  for(size_t i = 0; i < get_ncurve(); ++i) {
+    detail_->invalidate(i);
+    if(!detail_->curves[i]->Add(other.detail_->curves[i].get())) return false;
+  }
+  return true;
+}
+
+bool CutScan::save() const
+{
+  if(!filename_) return false;
+
+  YAML::Node node;
+  for(int axis = 0; axis < 3; ++axis) {
+    YAML::Node axis_node;
+    axis_node["nbin"] = detail_->nbin[axis];
+    axis_node["boundary"] = vector<double>{ detail_->lb[axis], detail_->ub[axis] };
+    node["axes"].push_back(axis_node);
+  }
+  for(size_t i = 0; i < get_ncurve(); ++i) {
+    YAML::Node curve;
+    curve["title"] = detail_->curve_titles[i];
+    curve["signal"] = (bool)detail_->curve_issignal[i];
+    node["curves"].push_back(curve);
+  }
+
+  // Write to a temporary file first, so that no partial scan is left.
+  string tmpname = string(filename_) + ".tmp";
+  {
+    unique_ptr<TFile> file(TFile::Open(tmpname.c_str(), "RECREATE"));
+    if(!file || file->IsZombie()) return false;
+    TObjString meta(YAML::Dump(node).c_str());
+    file->WriteTObject(&meta, "meta");
+    for(size_t i = 0; i < get_ncurve(); ++i) {
+      file->WriteTObject(detail_->curves[i].get(), ("curve_" + to_string(i)).c_str());
+    }
+    file->Close();
+  }
+  if(rename(tmpname.c_str(), filename_)) return false;
+  clog << "Info: saved scan of " << get_ncurve() << " curves to " << filename_ << endl;
+  return true;
+}
+
+bool CutScan::load(const char *filename)
+{
+  if(!Stat(filename).isreg()) return false;
+  unique_ptr<TFile> file(TFile::Open(filename));
+  if(!file || file->IsZombie()) return false;
+  unique_ptr<TObjString> meta(dynamic_cast<TObjString *>(file->Get("meta")));
+  if(!meta) return false;
+
+  try {
+    YAML::Node node = YAML::Load(meta->GetString().Data());
+    if(node["axes"].size() != 3) return false;
+    size_t nbin[3];
+    double lb[3], ub[3];
+    for(int axis = 0; axis < 3; ++axis) {
+      const YAML::Node &axis_node = node["axes"][axis];
+      vector<double> boundary = axis_node["boundary"].as<vector<double>>();
+      if(boundary.size() != 2) return false;
+      nbin[axis] = axis_node["nbin"].as<size_t>();
+      lb[axis] = boundary[0], ub[axis] = boundary[1];
+    }
+    vector<unique_ptr<TH3>> curves;
+    vector<string> curve_titles;
+    vector<bool> curve_issignal;
+    for(const YAML::Node &curve_node : node["curves"]) {
+      string name = "curve_" + to_string(curves.size());
+      TH3 *curve = dynamic_cast<TH3 *>(file->Get(name.c_str()));
+      if(!curve) return false;
+      curve->SetDirectory(nullptr);
+      curves.emplace_back(curve);
+      curve_titles.push_back(curve_node["title"].as<string>());
+      curve_issignal.push_back(curve_node["signal"].as<bool>());
+    }
+
+    for(int axis = 0; axis < 3; ++axis) {
+      detail_->nbin[axis] = nbin[axis], detail_->lb[axis] = lb[axis], detail_->ub[axis] = ub[axis];
+    }
+    detail_->curves = std::move(curves);
+    detail_->curve_titles = std::move(curve_titles);
+    detail_->curve_issignal = std::move(curve_issignal);
+    detail_->cumw.clear();
+    detail_->cumw2.clear();
+  } catch(const YAML::Exception &e) {
+    cerr << "Warning: ignoring broken scan " << filename << ": " << e.what() << endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,82 @@
+#include "EventViewer.h"
+#include "MultiStep.h"
+#include <cxxabi.h>
+#include <typeinfo>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+
+using namespace std;
+
+bool EventViewer::profiling_ = false;
+
+void EventViewer::loop()
+{
+  while(counted_next()) if(counted_process()) counted_proceed();
+  if(profiling_ && profile_summary_) print_profile();
+}
+
+void EventViewer::set_profiling(bool enable)
+{
+  profiling_ = enable;
+}
+
+double EventViewer::now()
+{
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool EventViewer::tally(CounterKind kind, bool pass, double start)
+{
+  Counters &counters = counters_[kind];
+  ++counters.ncall;
+  counters.npass += pass;
+  counters.seconds += now() - start;
+  return pass;
+}
+
+void EventViewer::merge_counters(const EventViewer &other)
+{
+  for(size_t i = 0; i < NCOUNTER; ++i) {
+    counters_[i].ncall += other.counters_[i].ncall;
+    counters_[i].npass += other.counters_[i].npass;
+    counters_[i].seconds += other.counters_[i].seconds;
+  }
+}
+
+void EventViewer::print_profile() const
+{
+  clog << "Info: profile of " << (counters_[NEXT].npass) << " events" << endl;
+  clog << "Info:   " << left << setw(32) << "stage" << right
+       << setw(12) << "calls" << setw(12) << "passed" << setw(10) << "pass%"
+       << setw(12) << "process s" << setw(12) << "proceed s" << endl;
+  if(counters_[NEXT].ncall) {
+    clog << "Info:   " << left << setw(32) << "(next)" << right << setw(12) << counters_[NEXT].ncall
+         << setw(12) << counters_[NEXT].npass << setw(10) << ""
+         << setw(12) << fixed << setprecision(3) << counters_[NEXT].seconds << defaultfloat << endl;
+  }
+  print_profile_tree(0);
+}
+
+void EventViewer::print_profile_tree(size_t depth) const
+{
+  // Stages are named after their demangled dynamic type, children indented.
+  const char *mangled = typeid(*this).name();
+  int status;
+  unique_ptr<char, void (*)(void *)> demangled(abi::__cxa_demangle(mangled, nullptr, nullptr, &status), free);
+  string name = string(2 * depth, ' ') + (status == 0 ? demangled.get() : mangled);
+  const Counters &process = counters_[PROCESS], &proceed = counters_[PROCEED];
+  clog << "Info:   " << left << setw(32) << name << right
+       << setw(12) << process.ncall << setw(12) << process.npass
+       << setw(10) << fixed << setprecision(2) << (process.ncall ? 100.0 * process.npass / process.ncall : 0.0)
+       << setw(12) << setprecision(3) << process.seconds
+       << setw(12) << proceed.seconds << defaultfloat << endl;
+  const MultiStep *step = dynamic_cast<const MultiStep *>(this);
+  for(size_t i = 0; step && i < step->get_nthen(); ++i) {
+    const EventViewer *child = step->get_then(i);
+    if(child) child->print_profile_tree(depth + 1);
+  }
+}
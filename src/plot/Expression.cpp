@@ -0,0 +1,486 @@
+#include "Expression.h"
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+using namespace std;
+
+namespace {
+
+enum Op {
+  CONST, SYMBOL,
+  NEG, NOT, ABS, SQRT, EXP, LOG, SIN, COS, TANH,
+  ADD, SUB, MUL, DIV, POW, MIN, MAX, LT, LE, GT, GE, EQ, NE, AND, OR,
+  SELECT,
+};
+
+struct Function { const char *name; Op op; size_t narg; };
+
+const Function FUNCTIONS[] = {
+  { "abs", ABS, 1 }, { "sqrt", SQRT, 1 }, { "exp", EXP, 1 }, { "log", LOG, 1 },
+  { "sin", SIN, 1 }, { "cos", COS, 1 }, { "tanh", TANH, 1 },
+  { "min", MIN, 2 }, { "max", MAX, 2 }, { "pow", POW, 2 },
+};
+
+size_t get_narg(Op op)
+{
+  if(op <= SYMBOL) return 0;
+  if(op <= TANH) return 1;
+  if(op <= OR) return 2;
+  return 3;
+}
+
+// Syntax tree node.
+struct Node {
+  Op op;
+  double value;  // CONST
+  size_t symbol;  // SYMBOL
+  size_t arg[3];
+};
+
+// Instruction operand.
+struct Operand {
+  enum Kind { IMM, COLUMN, REG } kind;
+  double value;  // IMM
+  size_t index;  // COLUMN or REG
+};
+
+struct Instruction {
+  Op op;
+  Operand arg[3];
+  size_t dst;
+};
+
+double eval_scalar(Op op, const double *x)
+{
+  switch(op) {
+    case NEG: return -x[0];
+    case NOT: return x[0] == 0.0;
+    case ABS: return fabs(x[0]);
+    case SQRT: return sqrt(x[0]);
+    case EXP: return exp(x[0]);
+    case LOG: return log(x[0]);
+    case SIN: return sin(x[0]);
+    case COS: return cos(x[0]);
+    case TANH: return tanh(x[0]);
+    case ADD: return x[0] + x[1];
+    case SUB: return x[0] - x[1];
+    case MUL: return x[0] * x[1];
+    case DIV: return x[0] / x[1];
+    case POW: return pow(x[0], x[1]);
+    case MIN: return fmin(x[0], x[1]);
+    case MAX: return fmax(x[0], x[1]);
+    case LT: return x[0] < x[1];
+    case LE: return x[0] <= x[1];
+    case GT: return x[0] > x[1];
+    case GE: return x[0] >= x[1];
+    case EQ: return x[0] == x[1];
+    case NE: return x[0] != x[1];
+    case AND: return x[0] != 0.0 && x[1] != 0.0;
+    case OR: return x[0] != 0.0 || x[1] != 0.0;
+    case SELECT: return x[0] != 0.0 ? x[1] : x[2];
+    default: return NAN;
+  }
+}
+
+// Loops specialized on which operands are columns, so that each vectorizes.
+template<class F>
+void kernel1(F f, const double *a, double *out, size_t n)
+{
+  for(size_t k = 0; k < n; ++k) out[k] = f(a[k]);
+}
+
+template<class F>
+void kernel2(F f, const double *a, bool va, const double *b, bool vb, double *out, size_t n)
+{
+  if(va && vb) { for(size_t k = 0; k < n; ++k) out[k] = f(a[k], b[k]); }
+  else if(va) { double y = *b; for(size_t k = 0; k < n; ++k) out[k] = f(a[k], y); }
+  else { double x = *a; for(size_t k = 0; k < n; ++k) out[k] = f(x, b[k]); }
+}
+
+void run(Op op, const double *const *x, const bool *v, double *out, size_t n)
+{
+  switch(op) {
+    case NEG: kernel1([](double a) { return -a; }, x[0], out, n); break;
+    case NOT: kernel1([](double a) { return (double)(a == 0.0); }, x[0], out, n); break;
+    case ABS: kernel1([](double a) { return fabs(a); }, x[0], out, n); break;
+    case SQRT: kernel1([](double a) { return sqrt(a); }, x[0], out, n); break;
+    case EXP: kernel1([](double a) { return exp(a); }, x[0], out, n); break;
+    case LOG: kernel1([](double a) { return log(a); }, x[0], out, n); break;
+    case SIN: kernel1([](double a) { return sin(a); }, x[0], out, n); break;
+    case COS: kernel1([](double a) { return cos(a); }, x[0], out, n); break;
+    case TANH: kernel1([](double a) { return tanh(a); }, x[0], out, n); break;
+    case ADD: kernel2([](double a, double b) { return a + b; }, x[0], v[0], x[1], v[1], out, n); break;
+    case SUB: kernel2([](double a, double b) { return a - b; }, x[0], v[0], x[1], v[1], out, n); break;
+    case MUL: kernel2([](double a, double b) { return a * b; }, x[0], v[0], x[1], v[1], out, n); break;
+    case DIV: kernel2([](double a, double b) { return a / b; }, x[0], v[0], x[1], v[1], out, n); break;
+    case POW: kernel2([](double a, double b) { return pow(a, b); }, x[0], v[0], x[1], v[1], out, n); break;
+    case MIN: kernel2([](double a, double b) { return fmin(a, b); }, x[0], v[0], x[1], v[1], out, n); break;
+    case MAX: kernel2([](double a, double b) { return fmax(a, b); }, x[0], v[0], x[1], v[1], out, n); break;
+    case LT: kernel2([](double a, double b) { return (double)(a < b); }, x[0], v[0], x[1], v[1], out, n); break;
+    case LE: kernel2([](double a, double b) { return (double)(a <= b); }, x[0], v[0], x[1], v[1], out, n); break;
+    case GT: kernel2([](double a, double b) { return (double)(a > b); }, x[0], v[0], x[1], v[1], out, n); break;
+    case GE: kernel2([](double a, double b) { return (double)(a >= b); }, x[0], v[0], x[1], v[1], out, n); break;
+    case EQ: kernel2([](double a, double b) { return (double)(a == b); }, x[0], v[0], x[1], v[1], out, n); break;
+    case NE: kernel2([](double a, double b) { return (double)(a != b); }, x[0], v[0], x[1], v[1], out, n); break;
+    case AND: kernel2([](double a, double b) { return (double)((a != 0.0) & (b != 0.0)); }, x[0], v[0], x[1], v[1], out, n); break;
+    case OR: kernel2([](double a, double b) { return (double)((a != 0.0) | (b != 0.0)); }, x[0], v[0], x[1], v[1], out, n); break;
+    case SELECT:
+      for(size_t k = 0; k < n; ++k) out[k] = x[0][v[0] * k] != 0.0 ? x[1][v[1] * k] : x[2][v[2] * k];
+      break;
+    default: break;
+  }
+}
+
+}  // namespace
+
+class Expression::Detail {
+public:
+  string source;
+  vector<Node> nodes;
+  size_t root;
+  vector<string> symbols;
+
+  // Compiled form, built on first eval().
+  bool compiled;
+  vector<Instruction> code;
+  Operand result;
+  size_t nreg;
+  mutable vector<vector<double>> regs;
+
+  // Recursive descent parser.
+  const char *pos;
+
+  [[noreturn]] void error(const string &what) const {
+    throw logic_error("expression \"" + source + "\" at " + to_string(pos - source.c_str()) + ": " + what);
+  }
+
+  void skip() { while(isspace((unsigned char)*pos)) ++pos; }
+
+  bool accept(const char *token) {
+    skip();
+    size_t len = strlen(token);
+    if(strncmp(pos, token, len)) return false;
+    // Do not take "<" out of "<=" and the like.
+    if(len == 1 && strchr("<>=!", *token) && pos[1] == '=') return false;
+    if(len == 1 && strchr("&|", *token) && pos[1] == *token) return false;
+    pos += len;
+    return true;
+  }
+
+  void expect(const char *token) { if(!accept(token)) error(string("expected \"") + token + "\""); }
+
+  size_t add(Op op, size_t a = -1, size_t b = -1, size_t c = -1) {
+    nodes.push_back({ op, 0.0, 0, { a, b, c } });
+    return nodes.size() - 1;
+  }
+
+  size_t add_symbol(const string &name) {
+    size_t i = find(symbols.begin(), symbols.end(), name) - symbols.begin();
+    if(i == symbols.size()) symbols.push_back(name);
+    size_t node = add(SYMBOL);
+    nodes[node].symbol = i;
+    return node;
+  }
+
+  size_t parse_select() {
+    size_t cond = parse_binary(0);
+    if(!accept("?")) return cond;
+    size_t a = parse_select();
+    expect(":");
+    size_t b = parse_select();
+    return add(SELECT, cond, a, b);
+  }
+
+  // Binary operators by level of increasing precedence.
+  size_t parse_binary(int level) {
+    static const vector<vector<pair<const char *, Op>>> LEVELS = {
+      { { "||", OR } },
+      { { "&&", AND } },
+      { { "==", EQ }, { "!=", NE } },
+      { { "<=", LE }, { ">=", GE }, { "<", LT }, { ">", GT } },
+      { { "+", ADD }, { "-", SUB } },
+      { { "*", MUL }, { "/", DIV } },
+    };
+    if(level == (int)LEVELS.size()) return parse_unary();
+    size_t lhs = parse_binary(level + 1);
+    for(;;) {
+      bool found = false;
+      for(const auto &token_op : LEVELS[level]) {
+        if(!accept(token_op.first)) continue;
+        lhs = add(token_op.second, lhs, parse_binary(level + 1));
+        found = true;
+        break;
+      }
+      if(!found) return lhs;
+    }
+  }
+
+  size_t parse_unary() {
+    if(accept("-")) return add(NEG, parse_unary());
+    if(accept("+")) return parse_unary();
+    if(accept("!")) return add(NOT, parse_unary());
+    size_t base = parse_primary();
+    if(accept("^")) return add(POW, base, parse_unary());
+    return base;
+  }
+
+  size_t parse_primary() {
+    skip();
+    if(accept("(")) {
+      size_t node = parse_select();
+      expect(")");
+      return node;
+    }
+    if(isdigit((unsigned char)*pos) || *pos == '.') {
+      char *end;
+      double value = strtod(pos, &end);
+      if(end == pos) error("bad number");
+      pos = end;
+      size_t node = add(CONST);
+      nodes[node].value = value;
+      return node;
+    }
+    if(isalpha((unsigned char)*pos) || *pos == '_') {
+      const char *begin = pos;
+      while(isalnum((unsigned char)*pos) || *pos == '_' || *pos == '.') ++pos;
+      string name(begin, pos);
+      if(accept("(")) return parse_call(name);
+      if(accept("[")) {
+        skip();
+        const char *index_begin = pos;
+        while(isdigit((unsigned char)*pos)) ++pos;
+        if(pos == index_begin) error("expected constant index");
+        name += "[" + string(index_begin, pos) + "]";
+        expect("]");
+      }
+      return add_symbol(name);
+    }
+    error(*pos ? "unexpected character" : "unexpected end");
+  }
+
+  size_t parse_call(const string &name) {
+    const Function *function = nullptr;
+    for(const Function &f : FUNCTIONS) if(name == f.name) function = &f;
+    if(!function) error("unknown function " + name);
+    size_t arg[2] = { (size_t)-1, (size_t)-1 };
+    for(size_t i = 0; i < function->narg; ++i) {
+      if(i) expect(",");
+      arg[i] = parse_select();
+    }
+    expect(")");
+    return add(function->op, arg[0], arg[1]);
+  }
+
+  // Drop symbols no longer referenced and renumber the rest.
+  void compact_symbols() {
+    vector<size_t> remap(symbols.size(), -1);
+    vector<string> used;
+    // Number symbols in order of appearance from the left.
+    auto visit = [&](auto &self, size_t node) -> void {
+      const Node &nd = nodes[node];
+      if(nd.op == SYMBOL && remap[nd.symbol] == (size_t)-1) {
+        remap[nd.symbol] = used.size();
+        used.push_back(symbols[nd.symbol]);
+      }
+      for(size_t i = 0; i < get_narg(nd.op); ++i) self(self, nd.arg[i]);
+    };
+    visit(visit, root);
+    for(Node &nd : nodes) if(nd.op == SYMBOL && remap[nd.symbol] != (size_t)-1) nd.symbol = remap[nd.symbol];
+    symbols = std::move(used);
+    compiled = false;
+  }
+
+  // Emit code for a subtree, folding constants.
+  Operand emit(size_t node) {
+    const Node &nd = nodes[node];
+    if(nd.op == CONST) return { Operand::IMM, nd.value, 0 };
+    if(nd.op == SYMBOL) return { Operand::COLUMN, 0.0, nd.symbol };
+    size_t narg = get_narg(nd.op);
+    Instruction ins;
+    ins.op = nd.op;
+    bool folded = true;
+    double x[3];
+    for(size_t i = 0; i < narg; ++i) {
+      ins.arg[i] = emit(nd.arg[i]);
+      folded = folded && ins.arg[i].kind == Operand::IMM;
+      x[i] = ins.arg[i].value;
+    }
+    if(folded) return { Operand::IMM, eval_scalar(nd.op, x), 0 };
+    ins.dst = nreg++;
+    code.push_back(ins);
+    return { Operand::REG, 0.0, ins.dst };
+  }
+
+  void compile() {
+    code.clear();
+    nreg = 0;
+    result = emit(root);
+    regs.resize(nreg);
+    compiled = true;
+  }
+};
+
+Expression::Expression(const char *source)
+{
+  detail_ = new Detail;
+  detail_->source = source;
+  detail_->pos = detail_->source.c_str();
+  detail_->compiled = false;
+  try {
+    detail_->root = detail_->parse_select();
+    detail_->skip();
+    if(*detail_->pos) detail_->error("unexpected trailing characters");
+  } catch(...) {
+    delete detail_;
+    throw;
+  }
+}
+
+Expression::Expression(const Expression &other)
+{
+  detail_ = new Detail(*other.detail_);
+}
+
+Expression &Expression::operator=(const Expression &other)
+{
+  if(this != &other) *detail_ = *other.detail_;
+  return *this;
+}
+
+Expression::~Expression()
+{
+  delete detail_;
+}
+
+const char *Expression::get_source() const
+{
+  return detail_->source.c_str();
+}
+
+size_t Expression::get_nsymbol() const
+{
+  return detail_->symbols.size();
+}
+
+const char *Expression::get_symbol(size_t i) const
+{
+  return i < get_nsymbol() ? detail_->symbols[i].c_str() : nullptr;
+}
+
+size_t Expression::find_symbol(const char *name) const
+{
+  const vector<string> &symbols = detail_->symbols;
+  size_t i = find(symbols.begin(), symbols.end(), name) - symbols.begin();
+  return i == symbols.size() ? -1 : i;
+}
+
+bool Expression::substitute(const char *name, const Expression &other)
+{
+  size_t isymbol = find_symbol(name);
+  if(isymbol == (size_t)-1) return false;
+
+  // Append nodes of the other expression with its symbols mapped into ours.
+  Detail &d = *detail_;
+  size_t base = d.nodes.size();
+  for(Node nd : other.detail_->nodes) {
+    for(size_t i = 0; i < get_narg(nd.op); ++i) nd.arg[i] += base;
+    if(nd.op == SYMBOL) {
+      const string &symbol = other.detail_->symbols[nd.symbol];
+      size_t j = find(d.symbols.begin(), d.symbols.end(), symbol) - d.symbols.begin();
+      if(j == d.symbols.size()) d.symbols.push_back(symbol);
+      nd.symbol = j;
+    }
+    d.nodes.push_back(nd);
+  }
+  Node replacement = d.nodes[base + other.detail_->root];
+  for(size_t i = 0; i < base; ++i) {
+    if(d.nodes[i].op == SYMBOL && d.nodes[i].symbol == isymbol) d.nodes[i] = replacement;
+  }
+  d.compact_symbols();
+  return true;
+}
+
+bool Expression::substitute(const char *name, double value)
+{
+  size_t isymbol = find_symbol(name);
+  if(isymbol == (size_t)-1) return false;
+  for(Node &nd : detail_->nodes) {
+    if(nd.op == SYMBOL && nd.symbol == isymbol) nd.op = CONST, nd.value = value;
+  }
+  detail_->compact_symbols();
+  return true;
+}
+
+bool Expression::is_constant(double *value) const
+{
+  if(!detail_->compiled) detail_->compile();
+  if(detail_->result.kind != Operand::IMM) return false;
+  if(value) *value = detail_->result.value;
+  return true;
+}
+
+void Expression::eval(const double *const *columns, size_t n, double *out) const
+{
+  Detail &d = *detail_;
+  if(!d.compiled) d.compile();
+  for(auto &reg : d.regs) if(reg.size() < n) reg.resize(n);
+
+  auto locate = [&](const Operand &operand, bool &column) -> const double * {
+    column = operand.kind != Operand::IMM;
+    if(operand.kind == Operand::IMM) return &operand.value;
+    if(operand.kind == Operand::COLUMN) return columns[operand.index];
+    return d.regs[operand.index].data();
+  };
+  for(const Instruction &ins : d.code) {
+    const double *x[3];
+    bool v[3];
+    for(size_t i = 0; i < get_narg(ins.op); ++i) x[i] = locate(ins.arg[i], v[i]);
+    run(ins.op, x, v, d.regs[ins.dst].data(), n);
+  }
+  bool v;
+  const double *result = locate(d.result, v);
+  if(v) copy(result, result + n, out);
+  else fill(out, out + n, *result);
+}
+
+template<class T>
+static void gather_impl(const T *data, const size_t *offsets, size_t index, size_t n, double *out)
+{
+  // Scalar column: one element per event. offsets[n] == n alone does not
+  // imply it, as empty events may balance longer ones.
+  bool scalar = index == 0;
+  for(size_t k = 1; scalar && k <= n; ++k) scalar = offsets[k] == k;
+  if(scalar) {
+    for(size_t k = 0; k < n; ++k) out[k] = data[k];
+    return;
+  }
+  for(size_t k = 0; k < n; ++k) {
+    size_t pos = offsets[k] + index;
+    out[k] = pos < offsets[k + 1] ? (double)data[pos] : NAN;
+  }
+}
+
+bool Expression::gather(char type, const void *data, const size_t *offsets, size_t index, size_t n, double *out)
+{
+  switch(type) {
+    case 'F': gather_impl((const float *)data, offsets, index, n, out); return true;
+    case 'D': gather_impl((const double *)data, offsets, index, n, out); return true;
+    case 'I': gather_impl((const int32_t *)data, offsets, index, n, out); return true;
+    case 'i': gather_impl((const uint32_t *)data, offsets, index, n, out); return true;
+    case 'L': gather_impl((const int64_t *)data, offsets, index, n, out); return true;
+    case 'l': gather_impl((const uint64_t *)data, offsets, index, n, out); return true;
+    case 'S': gather_impl((const int16_t *)data, offsets, index, n, out); return true;
+    case 's': gather_impl((const uint16_t *)data, offsets, index, n, out); return true;
+    case 'B': gather_impl((const int8_t *)data, offsets, index, n, out); return true;
+    case 'b': gather_impl((const uint8_t *)data, offsets, index, n, out); return true;
+    case 'O': gather_impl((const bool *)data, offsets, index, n, out); return true;
+    default: return false;
+  }
+}
@@ -0,0 +1,56 @@
+#include "Hasher.h"
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+
+using namespace std;
+
+Hasher::Hasher()
+  : state_(0xcbf29ce484222325ULL)
+{
+  // empty
+}
+
+Hasher &Hasher::update(const void *data, size_t size)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  for(size_t i = 0; i < size; ++i) {
+    state_ ^= p[i];
+    state_ *= 0x100000001b3ULL;
+  }
+  return *this;
+}
+
+Hasher &Hasher::update(const string &s)
+{
+  update((uint64_t)s.size());
+  return update(s.data(), s.size());
+}
+
+Hasher &Hasher::update(uint64_t value)
+{
+  return update(&value, sizeof value);
+}
+
+Hasher &Hasher::update(double value)
+{
+  return update(&value, sizeof value);
+}
+
+bool Hasher::update_file(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if(file == NULL) return false;
+  shared_ptr<FILE> file_guard(file, [](FILE *f) { fclose(f); });
+  char buf[65536];
+  size_t n;
+  while((n = fread(buf, 1, sizeof buf, file)) > 0) update(buf, n);
+  return !ferror(file);
+}
+
+string Hasher::hexdigest() const
+{
+  char buf[17];
+  snprintf(buf, sizeof buf, "%016llx", (unsigned long long)state_);
+  return buf;
+}
@@ -1,15 +1,26 @@
 #include "HistOutput.h"
 #include "tdrstyle.h"
 #include "CMS_lumi.h"
+#include "fs.h"
 #include <TH1F.h>
 #include <TCanvas.h>
 #include <TLegend.h>
+#include <TFile.h>
+#include <TObjString.h>
+#include <yaml-cpp/yaml.h>
 #include <vector>
 #include <memory>
 #include <string>
 #include <utility>
+#include <tuple>
 #include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <mutex>
+#include <stdio.h>
 #include <math.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -24,7 +35,286 @@ public:
   vector<unique_ptr<TH1>> curves;
   vector<string> curve_titles;
   vector<bool> curve_issignal;
+  vector<double> curve_nevent, curve_nevent_total, curve_xs;  // NAN if unknown
   unique_ptr<TCanvas> canvas;
+  string cache_filename;
+  bool loaded;
+
+  // Batch fills of a binned curve, accumulated in double precision
+  // with underflow and overflow bins, and added to the curve on flush.
+  struct Accumulator {
+    vector<double> sumw, sumw2;
+    double stats[4];  // sumw, sumw2, sumwx, sumwx2 within range
+    double nentry;
+  };
+  vector<Accumulator> accumulators;
+  vector<int32_t> ibins;
+
+  template<class T>
+  size_t fill_batch(size_t i, const T *values, const double *weights, size_t n) {
+    size_t nbin_total = nbin + 2;
+    Accumulator &acc = accumulators[i];
+    if(acc.sumw.empty()) {
+      acc.sumw.assign(nbin_total, 0.0);
+      acc.sumw2.assign(nbin_total, 0.0);
+    }
+
+    // Compute bin indices without branches so that the loop vectorizes.
+    // Non-finite values or weights get index -1.
+    double lb = data_lb, scale = nbin / (data_ub - data_lb), fmax = nbin;
+    ibins.resize(n);
+    int32_t *ibin = ibins.data();
+    for(size_t k = 0; k < n; ++k) {
+      double x = values[k];
+      double w = weights ? weights[k] : 1.0;
+      double f = (x - lb) * scale;
+      f = f < -1.0 ? -1.0 : f;
+      f = f > fmax ? fmax : f;
+      bool finite = x - x == 0.0 && w - w == 0.0;
+      ibin[k] = finite ? (int32_t)(f + 1.0) : -1;
+    }
+
+    // Scatter weights into bins.
+    double *sumw = acc.sumw.data(), *sumw2 = acc.sumw2.data();
+    double stats[4] = { };
+    size_t nfilled = 0;
+    for(size_t k = 0; k < n; ++k) {
+      int32_t b = ibin[k];
+      if(b < 0) continue;
+      double x = values[k];
+      double w = weights ? weights[k] : 1.0;
+      sumw[b] += w;
+      sumw2[b] += w * w;
+      ++nfilled;
+      if(b == 0 || b == (int32_t)nbin + 1) continue;
+      stats[0] += w;
+      stats[1] += w * w;
+      stats[2] += w * x;
+      stats[3] += w * x * x;
+    }
+    for(size_t j = 0; j < 4; ++j) acc.stats[j] += stats[j];
+    acc.nentry += nfilled;
+    return nfilled;
+  }
+
+  // Bounded-memory summary of unbinned data, see set_sketch().
+  // Values are first buffered to find the bulk of the data, then summed into
+  // nfine bins: a linear core over [center - scale, center + scale), and on
+  // each side geometric bins reaching scale * SKETCH_REACH from the center.
+  // Far outliers thus land in coarse tail bins and leave the bulk at full
+  // resolution. Sketches with the same bins merge exactly.
+  struct Sketch {
+    size_t nfine;  // 0 if disabled
+    double qlow, qhigh;
+    vector<tuple<size_t, double, double>> buffer;  // (curve, value, weight)
+    double center, scale, log_gamma;  // scale = 0 while buffering
+    vector<double> count;  // unweighted, over all curves
+    vector<vector<double>> sumw, sumw2;
+    vector<double> nentry;
+
+    size_t get_ntail() const { return nfine / 4; }
+    size_t get_ncore() const { return nfine - 2 * get_ntail(); }
+    bool same_bins(const Sketch &other) const {
+      return nfine == other.nfine && center == other.center && scale == other.scale && log_gamma == other.log_gamma;
+    }
+
+    size_t index(double x) const {
+      size_t ntail = get_ntail(), ncore = get_ncore();
+      double d = x - center;
+      if(fabs(d) < scale) return min(ntail + (size_t)((d + scale) / (2.0 * scale) * ncore), ntail + ncore - 1);
+      size_t j = min(log(fabs(d) / scale) / log_gamma, (double)(ntail - 1));
+      return d > 0.0 ? ntail + ncore + j : ntail - 1 - j;
+    }
+
+    // Lower edge of fine bin k, k = nfine giving the upper edge of the last.
+    double edge(size_t k) const {
+      size_t ntail = get_ntail(), ncore = get_ncore();
+      if(k < ntail) return center - scale * exp((ntail - k) * log_gamma);
+      if(k > ntail + ncore) return center + scale * exp((k - ntail - ncore) * log_gamma);
+      return center - scale + 2.0 * scale * (k - ntail) / ncore;
+    }
+
+    double middle(size_t k) const { return 0.5 * (edge(k) + edge(k + 1)); }
+  } sketch;
+  static constexpr double SKETCH_REACH = 1e12;
+
+  // Bins shared by sketches of outputs filled in parallel, see share_sketch().
+  // Set by the first sketch to leave buffering and taken by the others.
+  struct SketchBins {
+    mutex lock;
+    bool set;
+    size_t nfine;
+    double center, scale, log_gamma;
+  };
+  shared_ptr<SketchBins> sketch_bins;
+
+  // Add a summary of n values to curve i, or counts only if i is -1.
+  void sketch_insert(size_t i, double x, double w, double w2, double n) {
+    if(sketch.scale == 0.0) {
+      sketch.buffer.emplace_back(i, x, w);
+      if(sketch.buffer.size() >= sketch.nfine) sketch_start();
+      return;
+    }
+    size_t k = sketch.index(x);
+    sketch.count[k] += n;
+    if(i == (size_t)-1) return;
+    sketch.sumw[i][k] += w;
+    sketch.sumw2[i][k] += w2;
+    sketch.nentry[i] += n;
+  }
+
+  // Leave the buffering phase once the bulk of the data is known: the core
+  // is centered on the median and spans twice the central 98% of values.
+  // Shared bins, else those of another sketch for an empty buffer, are
+  // taken as they are.
+  void sketch_start(const Sketch *other = nullptr) {
+    {
+      lock_guard<mutex> guard(sketch_bins->lock);
+      SketchBins &bins = *sketch_bins;
+      if(bins.set && bins.nfine == sketch.nfine) {
+        sketch.center = bins.center;
+        sketch.scale = bins.scale;
+        sketch.log_gamma = bins.log_gamma;
+      } else if(sketch.buffer.empty() && other) {
+        sketch.center = other->center;
+        sketch.scale = other->scale;
+        sketch.log_gamma = other->log_gamma;
+      } else {
+        vector<double> values;
+        for(const auto &ivw : sketch.buffer) values.push_back(get<1>(ivw));
+        sort(values.begin(), values.end());
+        auto quantile = [&values](double q) { return values[min((size_t)(q * values.size()), values.size() - 1)]; };
+        sketch.center = values.empty() ? 0.0 : quantile(0.5);
+        sketch.scale = values.empty() ? 0.0 : 2.0 * max(quantile(0.99) - sketch.center, sketch.center - quantile(0.01));
+        if(!(sketch.scale > 0.0)) sketch.scale = max(fabs(sketch.center), 1.0) * 1e-6;
+        sketch.log_gamma = log(SKETCH_REACH) / sketch.get_ntail();
+      }
+      if(!bins.set) {
+        bins.set = true;
+        bins.nfine = sketch.nfine;
+        bins.center = sketch.center;
+        bins.scale = sketch.scale;
+        bins.log_gamma = sketch.log_gamma;
+      }
+    }
+    sketch.count.assign(sketch.nfine, 0.0);
+    sketch.sumw.assign(data.size(), sketch.count);
+    sketch.sumw2.assign(data.size(), sketch.count);
+    sketch.nentry.assign(data.size(), 0.0);
+    vector<tuple<size_t, double, double>> buffer = std::move(sketch.buffer);
+    sketch.buffer = { };
+    for(const auto &ivw : buffer) {
+      double w = get<2>(ivw);
+      sketch_insert(get<0>(ivw), get<1>(ivw), w, w * w, 1.0);
+    }
+  }
+
+  // Add another sketch, bin by bin if binned alike, else by bin middles.
+  // Called once this sketch has left buffering.
+  void sketch_add(const Sketch &other) {
+    for(size_t k = 0; k < other.count.size(); ++k) {
+      size_t l = sketch.same_bins(other) ? k : sketch.index(other.middle(k));
+      sketch.count[l] += other.count[k];
+      for(size_t i = 0; i < other.sumw.size(); ++i) {
+        sketch.sumw[i][l] += other.sumw[i][k];
+        sketch.sumw2[i][l] += other.sumw2[i][k];
+      }
+    }
+    for(size_t i = 0; i < other.nentry.size(); ++i) sketch.nentry[i] += other.nentry[i];
+  }
+
+  // Value below which a fraction q of summarized values lie, rounded
+  // outwards to fine bin edges.
+  double sketch_quantile(double q, bool upper) const {
+    if(sketch.scale == 0.0) {
+      vector<double> values;
+      for(const auto &ivw : sketch.buffer) values.push_back(get<1>(ivw));
+      if(values.empty()) return NAN;
+      sort(values.begin(), values.end());
+      return values[min((size_t)(q * values.size()), values.size() - 1)];
+    }
+    double total = 0.0;
+    for(double n : sketch.count) total += n;
+    double sum = 0.0;
+    for(size_t k = 0; k < sketch.nfine; ++k) {
+      sum += sketch.count[k];
+      if(sum >= q * total && sketch.count[k] > 0) return sketch.edge(k + upper);
+    }
+    return sketch.edge(sketch.nfine);
+  }
+
+  // Add summarized values of a sketch into accumulators of binned curves.
+  void sketch_accumulate(const Sketch &from) {
+    if(from.scale == 0.0) {
+      for(const auto &ivw : from.buffer) curves[get<0>(ivw)]->Fill(get<1>(ivw), get<2>(ivw));
+      return;
+    }
+    double lb = data_lb, scale = nbin / (data_ub - data_lb);
+    for(size_t i = 0; i < from.sumw.size(); ++i) {
+      Accumulator &acc = accumulators[i];
+      if(acc.sumw.empty()) {
+        acc.sumw.assign(nbin + 2, 0.0);
+        acc.sumw2.assign(nbin + 2, 0.0);
+      }
+      for(size_t k = 0; k < from.nfine; ++k) {
+        double w = from.sumw[i][k], w2 = from.sumw2[i][k];
+        if(w == 0.0 && w2 == 0.0) continue;
+        double x = from.middle(k);
+        double f = min(max((x - lb) * scale, -1.0), (double)nbin);
+        size_t b = f + 1.0;
+        acc.sumw[b] += w;
+        acc.sumw2[b] += w2;
+        if(b == 0 || b == nbin + 1) continue;
+        acc.stats[0] += w;
+        acc.stats[1] += w2;
+        acc.stats[2] += w * x;
+        acc.stats[3] += w * x * x;
+      }
+      acc.nentry += from.nentry[i];
+    }
+  }
+
+  // Move summarized values into accumulators of binned curves.
+  void sketch_bin() {
+    sketch_accumulate(sketch);
+    sketch = { sketch.nfine, sketch.qlow, sketch.qhigh, { }, 0.0, 0.0, 0.0, { }, { }, { }, { } };
+  }
+
+  // Sum event counts of another output, known ones taking over unknown.
+  void merge_nevent(const Detail &other) {
+    for(size_t i = 0; i < curve_nevent.size(); ++i) {
+      if(isnan(other.curve_nevent[i])) continue;
+      if(isnan(curve_nevent[i])) {
+        curve_nevent[i] = other.curve_nevent[i];
+        curve_nevent_total[i] = other.curve_nevent_total[i];
+        curve_xs[i] = other.curve_xs[i];
+      } else {
+        curve_nevent[i] += other.curve_nevent[i];
+      }
+    }
+  }
+
+  // Add accumulated batch fills into curves.
+  void flush() {
+    for(size_t i = 0; i < accumulators.size(); ++i) {
+      Accumulator &acc = accumulators[i];
+      if(acc.nentry == 0) continue;
+      TH1 *curve = curves[i].get();
+      double stats[TH1::kNstat] = { };
+      curve->GetStats(stats);
+      if(curve->GetSumw2N() == 0) curve->Sumw2();
+      double *curve_sumw2 = curve->GetSumw2()->fArray;
+      for(size_t b = 0; b < acc.sumw.size(); ++b) {
+        curve->AddBinContent(b, acc.sumw[b]);
+        curve_sumw2[b] += acc.sumw2[b];
+      }
+      for(size_t j = 0; j < 4; ++j) stats[j] += acc.stats[j];
+      double nentry = curve->GetEntries() + acc.nentry;
+      curve->PutStats(stats);
+      curve->SetEntries(nentry);
+      acc = { };
+    }
+  }
 
   void init_cms_style() const {
     setTDRStyle();
@@ -57,7 +347,7 @@ public:
 HistOutput::HistOutput(const char *xtitle, const char *ytitle, const char *filename)
   : xtitle_(strdup(xtitle)), ytitle_(strdup(ytitle))
   , filename_(strdup(filename)), legend_pos_{0.65, 0.95, 0.75, 0.9}
-  , logx_(false), logy_(false), rangex_(false), rangey_(false), gridx_(false), gridy_(false)
+  , logx_(false), logy_(false), rangex_(false), rangey_(false), rangey_fit_(false), gridx_(false), gridy_(false)
   , xmin_(0.0), xmax_(0.0), ymin_(0.0), ymax_(0.0)
 {
   detail_ = new Detail;
@@ -67,6 +357,9 @@ HistOutput::HistOutput(const char *xtitle, const char *ytitle, const char *filen
   detail_->data_lb = +INFINITY;
   detail_->data_ub = -INFINITY;
   detail_->nbin = 50;
+  detail_->sketch.nfine = 0;
+  detail_->sketch_bins = make_shared<Detail::SketchBins>();
+  detail_->loaded = false;
   detail_->init_cms_style();
 }
 
@@ -79,12 +372,21 @@ HistOutput::~HistOutput()
   free(xtitle_);
 }
 
+void HistOutput::set_filename(const char *filename)
+{
+  free(filename_);
+  filename_ = filename ? strdup(filename) : nullptr;
+}
+
 size_t HistOutput::add_curve(const char *title, bool sg)
 {
   size_t i = detail_->data.size();
   detail_->data.emplace_back();
   detail_->curve_titles.emplace_back(title);
   detail_->curve_issignal.push_back(sg);
+  detail_->curve_nevent.push_back(NAN);
+  detail_->curve_nevent_total.push_back(NAN);
+  detail_->curve_xs.push_back(NAN);
   return i;
 }
 
@@ -96,6 +398,7 @@ size_t HistOutput::get_ncurve() const
 TH1 *HistOutput::get_curve(size_t i) const
 {
   if(i >= detail_->curves.size()) return nullptr;
+  detail_->flush();
   return detail_->curves[i].get();
 }
 
@@ -105,6 +408,14 @@ bool HistOutput::curve_issignal(size_t i) const
   return detail_->curve_issignal[i];
 }
 
+void HistOutput::set_curve_nevent(size_t i, double nevent, double nevent_total, double xs)
+{
+  if(i >= get_ncurve()) return;
+  detail_->curve_nevent[i] = nevent;
+  detail_->curve_nevent_total[i] = nevent_total;
+  detail_->curve_xs[i] = xs;
+}
+
 const char *HistOutput::get_curve_title(size_t i) const
 {
   if(i >= detail_->curve_titles.size()) return nullptr;
@@ -116,12 +427,31 @@ bool HistOutput::fill_curve(size_t i, double value, double weight) const
   if(i >= get_ncurve()) return false;
   if(!isfinite(value) || !isfinite(weight)) return false;
   if(is_binned()) { detail_->curves[i]->Fill(value, weight); return true; }
-  detail_->data[i].emplace_back(value, weight);
+  if(detail_->sketch.nfine) detail_->sketch_insert(i, value, weight, weight * weight, 1.0);
+  else detail_->data[i].emplace_back(value, weight);
   detail_->data_min = min(detail_->data_min, value);
   detail_->data_max = max(detail_->data_max, value);
   return true;
 }
 
+size_t HistOutput::fill_curve_batch(size_t i, const double *values, const double *weights, size_t n) const
+{
+  if(i >= get_ncurve()) return 0;
+  if(is_binned()) return detail_->fill_batch(i, values, weights, n);
+  size_t nfilled = 0;
+  for(size_t k = 0; k < n; ++k) nfilled += fill_curve(i, values[k], weights ? weights[k] : 1.0);
+  return nfilled;
+}
+
+size_t HistOutput::fill_curve_batch(size_t i, const float *values, const double *weights, size_t n) const
+{
+  if(i >= get_ncurve()) return 0;
+  if(is_binned()) return detail_->fill_batch(i, values, weights, n);
+  size_t nfilled = 0;
+  for(size_t k = 0; k < n; ++k) nfilled += fill_curve(i, values[k], weights ? weights[k] : 1.0);
+  return nfilled;
+}
+
 void HistOutput::get_boundary(double &lb, double &ub) const
 {
   double data_lb = detail_->data_lb;
@@ -130,6 +460,10 @@ void HistOutput::get_boundary(double &lb, double &ub) const
 
   double data_min = detail_->data_min;
   double data_max = detail_->data_max;
+  if(detail_->sketch.nfine && !is_binned()) {
+    if(detail_->sketch.qlow > 0.0) data_min = detail_->sketch_quantile(detail_->sketch.qlow, false);
+    if(detail_->sketch.qhigh < 1.0) data_max = detail_->sketch_quantile(detail_->sketch.qhigh, true);
+  }
   if(isfinite(data_min) && isfinite(data_max)) { lb = data_min, ub = data_max; return; }
 
   lb = 0.0, ub = 1.0;
@@ -151,6 +485,24 @@ void HistOutput::set_nbin(size_t nbin)
   detail_->nbin = nbin;
 }
 
+void HistOutput::set_sketch(size_t nfine, double qlow, double qhigh)
+{
+  // At least one linear bin on each side of the center and one tail bin each.
+  detail_->sketch.nfine = nfine ? max(nfine + nfine % 2, (size_t)4) : 0;
+  detail_->sketch.qlow = qlow;
+  detail_->sketch.qhigh = qhigh;
+}
+
+bool HistOutput::is_sketched() const
+{
+  return detail_->sketch.nfine;
+}
+
+void HistOutput::share_sketch(const HistOutput &other)
+{
+  detail_->sketch_bins = other.detail_->sketch_bins;
+}
+
 bool HistOutput::is_binned() const
 {
   return !detail_->curves.empty();
@@ -173,6 +525,188 @@ void HistOutput::bin()
     detail_->data[i] = { };
     detail_->curves.emplace_back(curve);
   }
+  detail_->accumulators.resize(get_ncurve());
+  if(detail_->sketch.nfine) detail_->sketch_bin();
+}
+
+void HistOutput::set_cache_filename(const char *filename)
+{
+  detail_->cache_filename = filename ? filename : "";
+}
+
+const char *HistOutput::get_cache_filename() const
+{
+  return detail_->cache_filename.empty() ? nullptr : detail_->cache_filename.c_str();
+}
+
+bool HistOutput::save_cache(const char *filename) const
+{
+  const_cast<HistOutput *>(this)->bin();
+  detail_->flush();
+
+  YAML::Node node;
+  node["xtitle"] = xtitle_ ? xtitle_ : "";
+  node["ytitle"] = ytitle_ ? ytitle_ : "";
+  node["legend"] = vector<double>{ legend_pos_.xl, legend_pos_.xh, legend_pos_.yl, legend_pos_.yh };
+  node["logx"] = logx_;
+  node["logy"] = logy_;
+  node["gridx"] = gridx_;
+  node["gridy"] = gridy_;
+  if(rangex_) node["rangex"] = vector<double>{ xmin_, xmax_ };
+  if(rangey_) node["rangey"] = vector<double>{ ymin_, ymax_ };
+  if(rangey_fit_) node["rangey_fit"] = true;
+  node["boundary"] = vector<double>{ detail_->data_lb, detail_->data_ub };
+  node["nbin"] = get_nbin();
+  for(size_t i = 0; i < get_ncurve(); ++i) {
+    YAML::Node curve;
+    curve["title"] = detail_->curve_titles[i];
+    curve["signal"] = (bool)detail_->curve_issignal[i];
+    if(!isnan(detail_->curve_nevent[i])) {
+      curve["nevent"] = detail_->curve_nevent[i];
+      curve["nevent_total"] = detail_->curve_nevent_total[i];
+      curve["xs"] = detail_->curve_xs[i];
+    }
+    node["curves"].push_back(curve);
+  }
+
+  // Write to a temporary file first, so that no partial cache is left.
+  string tmpname = string(filename) + ".tmp";
+  {
+    unique_ptr<TFile> file(TFile::Open(tmpname.c_str(), "RECREATE"));
+    if(!file || file->IsZombie()) return false;
+    TObjString meta(YAML::Dump(node).c_str());
+    file->WriteTObject(&meta, "meta");
+    for(size_t i = 0; i < get_ncurve(); ++i) {
+      file->WriteTObject(detail_->curves[i].get(), ("curve_" + to_string(i)).c_str());
+    }
+    file->Close();
+  }
+  return rename(tmpname.c_str(), filename) == 0;
+}
+
+bool HistOutput::load_cache(const char *filename)
+{
+  if(!Stat(filename).isreg()) return false;
+  unique_ptr<TFile> file(TFile::Open(filename));
+  if(!file || file->IsZombie()) return false;
+  unique_ptr<TObjString> meta(dynamic_cast<TObjString *>(file->Get("meta")));
+  if(!meta) return false;
+
+  try {
+    YAML::Node node = YAML::Load(meta->GetString().Data());
+    vector<unique_ptr<TH1>> curves;
+    vector<string> curve_titles;
+    vector<bool> curve_issignal;
+    vector<double> curve_nevent, curve_nevent_total, curve_xs;
+    for(const YAML::Node &curve_node : node["curves"]) {
+      string name = "curve_" + to_string(curves.size());
+      TH1 *curve = dynamic_cast<TH1 *>(file->Get(name.c_str()));
+      if(!curve) return false;
+      curve->SetDirectory(nullptr);
+      curves.emplace_back(curve);
+      curve_titles.push_back(curve_node["title"].as<string>());
+      curve_issignal.push_back(curve_node["signal"].as<bool>());
+      bool counted = (bool)curve_node["nevent"];
+      curve_nevent.push_back(counted ? curve_node["nevent"].as<double>() : NAN);
+      curve_nevent_total.push_back(counted ? curve_node["nevent_total"].as<double>() : NAN);
+      curve_xs.push_back(counted ? curve_node["xs"].as<double>() : NAN);
+    }
+    vector<double> legend = node["legend"].as<vector<double>>();
+    vector<double> boundary = node["boundary"].as<vector<double>>();
+    if(legend.size() != 4 || boundary.size() != 2) return false;
+
+    free(xtitle_);
+    xtitle_ = strdup(node["xtitle"].as<string>().c_str());
+    free(ytitle_);
+    ytitle_ = strdup(node["ytitle"].as<string>().c_str());
+    legend_pos_ = { legend[0], legend[1], legend[2], legend[3] };
+    logx_ = node["logx"].as<bool>();
+    logy_ = node["logy"].as<bool>();
+    gridx_ = node["gridx"].as<bool>();
+    gridy_ = node["gridy"].as<bool>();
+    rangex_ = (bool)node["rangex"];
+    if(rangex_) xmin_ = node["rangex"][0].as<double>(), xmax_ = node["rangex"][1].as<double>();
+    rangey_ = (bool)node["rangey"];
+    if(rangey_) ymin_ = node["rangey"][0].as<double>(), ymax_ = node["rangey"][1].as<double>();
+    rangey_fit_ = node["rangey_fit"] && node["rangey_fit"].as<bool>();
+    detail_->data_lb = boundary[0];
+    detail_->data_ub = boundary[1];
+    detail_->nbin = node["nbin"].as<size_t>();
+    detail_->data.assign(curves.size(), { });
+    detail_->accumulators.assign(curves.size(), { });
+    detail_->curves = std::move(curves);
+    detail_->curve_titles = std::move(curve_titles);
+    detail_->curve_issignal = std::move(curve_issignal);
+    detail_->curve_nevent = std::move(curve_nevent);
+    detail_->curve_nevent_total = std::move(curve_nevent_total);
+    detail_->curve_xs = std::move(curve_xs);
+    detail_->sketch = { };
+  } catch(const YAML::Exception &e) {
+    cerr << "Warning: ignoring broken cache " << filename << ": " << e.what() << endl;
+    return false;
+  }
+  detail_->loaded = true;
+  return true;
+}
+
+bool HistOutput::is_loaded() const
+{
+  return detail_->loaded;
+}
+
+void HistOutput::reset()
+{
+  for(auto &data : detail_->data) data = { };
+  for(auto &curve : detail_->curves) curve->Reset();
+  for(auto &acc : detail_->accumulators) acc = { };
+  Detail::Sketch &sketch = detail_->sketch;
+  sketch = { sketch.nfine, sketch.qlow, sketch.qhigh, { }, 0.0, 0.0, 0.0, { }, { }, { }, { } };
+  detail_->data_min = +INFINITY;
+  detail_->data_max = -INFINITY;
+  fill(detail_->curve_nevent.begin(), detail_->curve_nevent.end(), NAN);
+  detail_->loaded = false;
+}
+
+bool HistOutput::merge(const HistOutput &other)
+{
+  // Check compatibility first, so that nothing is merged on failure.
+  if(other.get_ncurve() != get_ncurve()) return false;
+  const Detail::Sketch &sketch = other.detail_->sketch;
+  bool other_sketched = !other.is_binned() && sketch.nfine;
+  if(other_sketched && !is_binned() && !detail_->sketch.nfine) return false;
+  if(other.is_binned() && get_ncurve()) {
+    const TAxis *axis = other.detail_->curves[0]->GetXaxis();
+    double lb, ub;
+    if(is_binned()) lb = detail_->curves[0]->GetXaxis()->GetXmin(), ub = detail_->curves[0]->GetXaxis()->GetXmax();
+    else get_boundary(lb, ub);
+    size_t nbin = is_binned() ? detail_->curves[0]->GetNbinsX() : get_nbin();
+    if(nbin != (size_t)axis->GetNbins() || lb != axis->GetXmin() || ub != axis->GetXmax()) return false;
+  }
+
+  if(other.is_binned()) {
+    bin();
+    detail_->flush();
+    other.detail_->flush();
+    for(size_t i = 0; i < get_ncurve(); ++i) detail_->curves[i]->Add(other.detail_->curves[i].get());
+  } else if(!other_sketched) {
+    for(size_t i = 0; i < get_ncurve(); ++i) {
+      for(const auto &vw : other.detail_->data[i]) fill_curve(i, vw.first, vw.second);
+    }
+  } else {
+    for(const auto &ivw : sketch.buffer) fill_curve(get<0>(ivw), get<1>(ivw), get<2>(ivw));
+    if(sketch.scale != 0.0) {
+      if(is_binned()) {
+        detail_->sketch_accumulate(sketch);
+      } else {
+        if(detail_->sketch.scale == 0.0) detail_->sketch_start(&sketch);
+        detail_->sketch_add(sketch);
+      }
+    }
+    detail_->data_min = min(detail_->data_min, other.detail_->data_min);
+    detail_->data_max = max(detail_->data_max, other.detail_->data_max);
+  }
+  detail_->merge_nevent(*other.detail_);
+  return true;
 }
 
 bool HistOutput::save() const
@@ -188,14 +722,37 @@ bool HistOutput::save() const
 
   vector<TH1 *> sg;
   vector<unique_ptr<TH1>> bg;
+  const_cast<HistOutput *>(this)->bin();
+  detail_->flush();
+  if(get_cache_filename() && !is_loaded() && !save_cache(get_cache_filename())) {
+    cerr << "Warning: failed to save cache: " << get_cache_filename() << endl;
+  }
+
   TCanvas *canvas = detail_->canvas.get();
   canvas->cd();
 
+  double ymax = ymax_;
+  if(rangey_fit_) {
+    ymax = 0.0;
+    for(const auto &curve : detail_->curves) {
+      for(size_t j = 1; j <= get_nbin(); ++j) ymax = max(ymax, curve->GetBinContent(j));
+    }
+    ymax *= 1.2;
+  }
+
   for(size_t i = 0; i < get_ncurve(); ++i) {
     const_cast<HistOutput *>(this)->bin();
     TH1 *curve = detail_->curves[i].get();
+    string title = detail_->curve_titles[i];
+    if(!isnan(detail_->curve_nevent[i])) {
+      ostringstream oss;
+      oss << " (" << (size_t)detail_->curve_nevent[i] << "/" << (size_t)detail_->curve_nevent_total[i]
+          << " events scaled to " << scientific << setprecision(3) << detail_->curve_xs[i] << " pb)";
+      title += oss.str();
+    }
+    curve->SetTitle(title.c_str());
     if(rangex_) curve->GetXaxis()->SetRangeUser(xmin_, xmax_);
-    if(rangey_) curve->GetYaxis()->SetRangeUser(ymin_, ymax_);
+    if(rangey_) curve->GetYaxis()->SetRangeUser(ymin_, ymax);
     curve->SetLineColor(i + 2);
     if(detail_->curve_issignal[i]) {  // SG: independent.
       sg.push_back(curve);
@@ -204,7 +761,7 @@ bool HistOutput::save() const
       TH1 *clone = (TH1 *)curve->Clone();
       if(!bg.empty()) clone->Add(bg.back().get());
       if(rangex_) clone->GetXaxis()->SetRangeUser(xmin_, xmax_);
-      if(rangey_) clone->GetYaxis()->SetRangeUser(ymin_, ymax_);
+      if(rangey_) clone->GetYaxis()->SetRangeUser(ymin_, ymax);
       bg.emplace_back(clone);
     }
   }
@@ -0,0 +1,218 @@
+#include "Ledger.h"
+#include "HistOutput.h"
+#include "Hasher.h"
+#include "fs.h"
+#include <yaml-cpp/yaml.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace {
+
+// Output to load partials into.
+class PartialHist : public HistOutput {
+public:
+  PartialHist() : HistOutput("", "", "") { set_filename(nullptr); }
+  virtual bool process() override { return false; }
+};
+
+}  // namespace
+
+class Ledger::Detail {
+public:
+  struct Record {
+    size_t size;
+    long long mtime;
+    size_t nevent;
+    vector<string> partials;
+  };
+  map<string, Record> records;
+  mutable bool dirty;  // records not yet written to the index
+  mutable mutex lock;
+
+  string get_index_filename(const char *dirpath) const {
+    return string(dirpath) + "/ledger.yaml";
+  }
+
+  string get_partial_filename(const char *dirpath, const string &path, size_t i) const {
+    Hasher hasher;
+    hasher.update(path);
+    return string(dirpath) + "/" + basename(path) + "." + hasher.hexdigest() + "." + to_string(i) + ".root";
+  }
+
+  void remove_partials(const Record &record) const {
+    for(const string &partial : record.partials) remove(partial.c_str());
+  }
+
+  // Called with lock held.
+  bool save(const char *dirpath) const {
+    YAML::Node node;
+    for(const auto &path_record : records) {
+      YAML::Node record_node;
+      record_node["path"] = path_record.first;
+      record_node["size"] = path_record.second.size;
+      record_node["mtime"] = path_record.second.mtime;
+      record_node["nevent"] = path_record.second.nevent;
+      record_node["partials"] = path_record.second.partials;
+      node.push_back(record_node);
+    }
+
+    // Write to a temporary file first, so that no partial index is left.
+    string filename = get_index_filename(dirpath);
+    string tmpname = filename + ".tmp";
+    {
+      ofstream ofs(tmpname);
+      ofs << YAML::Dump(node) << endl;
+      if(!ofs) return false;
+    }
+    if(rename(tmpname.c_str(), filename.c_str())) return false;
+    dirty = false;
+    return true;
+  }
+};
+
+Ledger::Ledger(const char *dirpath)
+  : dirpath_(strdup(dirpath))
+{
+  detail_ = new Detail;
+  detail_->dirty = false;
+  string path = dirpath;
+  for(size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+    string prefix = path.substr(0, pos);
+    if(mkdir(prefix.c_str(), 0755) && errno != EEXIST) {
+      cerr << "Warning: failed to create ledger directory " << prefix << ": " << strerror(errno) << endl;
+      break;
+    }
+    if(pos == string::npos) break;
+  }
+
+  string filename = detail_->get_index_filename(dirpath);
+  if(!Stat(filename.c_str()).isreg()) return;
+  try {
+    for(const YAML::Node &record_node : YAML::LoadFile(filename)) {
+      Detail::Record record;
+      record.size = record_node["size"].as<size_t>();
+      record.mtime = record_node["mtime"].as<long long>();
+      record.nevent = record_node["nevent"].as<size_t>();
+      record.partials = record_node["partials"].as<vector<string>>();
+      detail_->records[record_node["path"].as<string>()] = record;
+    }
+  } catch(const YAML::Exception &e) {
+    cerr << "Warning: ignoring broken ledger " << filename << ": " << e.what() << endl;
+    detail_->records.clear();
+  }
+  clog << "Info: loaded " << detail_->records.size() << " records from ledger " << filename << endl;
+}
+
+Ledger::~Ledger()
+{
+  if(!save()) cerr << "Warning: failed to save ledger in " << dirpath_ << endl;
+  delete detail_;
+  free(dirpath_);
+}
+
+bool Ledger::is_current(const char *path) const
+{
+  lock_guard<mutex> guard(detail_->lock);
+  auto iter = detail_->records.find(path);
+  if(iter == detail_->records.end()) return false;
+  Stat st(path);
+  return st.exists() && st.size() == iter->second.size && st.mtime() == iter->second.mtime;
+}
+
+size_t Ledger::get_nevent(const char *path) const
+{
+  lock_guard<mutex> guard(detail_->lock);
+  auto iter = detail_->records.find(path);
+  return iter == detail_->records.end() ? 0 : iter->second.nevent;
+}
+
+size_t Ledger::get_nrecord() const
+{
+  lock_guard<mutex> guard(detail_->lock);
+  return detail_->records.size();
+}
+
+size_t Ledger::prune(const vector<string> &paths)
+{
+  lock_guard<mutex> guard(detail_->lock);
+  map<string, Detail::Record> kept;
+  for(const string &path : paths) {
+    auto iter = detail_->records.find(path);
+    if(iter == detail_->records.end()) continue;
+    Stat st(path.c_str());
+    if(!st.exists() || st.size() != iter->second.size || st.mtime() != iter->second.mtime) continue;
+    kept.insert(*iter);
+    detail_->records.erase(iter);
+  }
+  size_t ndropped = detail_->records.size();
+  for(const auto &path_record : detail_->records) {
+    clog << "Info: dropping ledger record: " << path_record.first << endl;
+    detail_->remove_partials(path_record.second);
+  }
+  detail_->records = std::move(kept);
+  detail_->dirty = detail_->dirty || ndropped;
+  if(detail_->dirty && !detail_->save(dirpath_)) cerr << "Warning: failed to save ledger in " << dirpath_ << endl;
+  return ndropped;
+}
+
+bool Ledger::record(const char *path, size_t nevent, const vector<HistOutput *> &hists)
+{
+  Stat st(path);
+  Detail::Record record = { st.size(), st.mtime(), nevent, { } };
+  bool ok = true;
+  for(size_t i = 0; ok && i < hists.size(); ++i) {
+    string partial = detail_->get_partial_filename(dirpath_, path, i);
+    ok = hists[i]->save_cache(partial.c_str());
+    record.partials.push_back(partial);
+  }
+  if(!ok) {
+    cerr << "Warning: failed to save partials of " << path << " in " << dirpath_ << endl;
+    detail_->remove_partials(record);
+    return false;
+  }
+  for(HistOutput *hist : hists) hist->reset();
+
+  lock_guard<mutex> guard(detail_->lock);
+  detail_->records[path] = std::move(record);
+  detail_->dirty = true;
+  return true;
+}
+
+bool Ledger::sum(const vector<HistOutput *> &hists) const
+{
+  lock_guard<mutex> guard(detail_->lock);
+  vector<PartialHist> partial_hists(hists.size());
+  for(const auto &path_record : detail_->records) {
+    const vector<string> &partials = path_record.second.partials;
+    if(partials.size() != hists.size()) {
+      cerr << "Warning: ledger record with " << partials.size() << " partials instead of "
+           << hists.size() << ": " << path_record.first << endl;
+      return false;
+    }
+    for(size_t i = 0; i < hists.size(); ++i) {
+      PartialHist &partial = partial_hists[i];
+      if(!partial.load_cache(partials[i].c_str()) || !hists[i]->merge(partial)) {
+        cerr << "Warning: failed to add partial " << partials[i] << endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool Ledger::save() const
+{
+  lock_guard<mutex> guard(detail_->lock);
+  return !detail_->dirty || detail_->save(dirpath_);
+}
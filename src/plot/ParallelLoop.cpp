@@ -0,0 +1,171 @@
+#include "ParallelLoop.h"
+#include "TreeInput.h"
+#include "HistOutput.h"
+#include "CutScan.h"
+#include "MultiStep.h"
+#include <TROOT.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+// Merge results of worker chain into master chain.
+static void merge_chain(EventViewer *master, EventViewer *worker)
+{
+  vector<EventViewer *> master_chain = MultiStep::get_tree(master);
+  vector<EventViewer *> worker_chain = MultiStep::get_tree(worker);
+  if(master_chain.size() != worker_chain.size()) {
+    cerr << "Warning: skipping worker chain of different size" << endl;
+    return;
+  }
+  for(size_t i = 0; i < master_chain.size(); ++i) {
+    master_chain[i]->merge_counters(*worker_chain[i]);
+    HistOutput *master_hist = dynamic_cast<HistOutput *>(master_chain[i]);
+    HistOutput *worker_hist = dynamic_cast<HistOutput *>(worker_chain[i]);
+    if(master_hist && worker_hist && !master_hist->merge(*worker_hist)) {
+      cerr << "Warning: failed to merge curves of " << master_hist->get_filename() << endl;
+    }
+    CutScan *master_scan = dynamic_cast<CutScan *>(master_chain[i]);
+    CutScan *worker_scan = dynamic_cast<CutScan *>(worker_chain[i]);
+    if(master_scan && worker_scan && !master_scan->merge(*worker_scan)) {
+      cerr << "Warning: failed to merge scan of " << master_scan->get_filename() << endl;
+    }
+  }
+}
+
+// Per-chain task queues with stealing.
+class TaskQueues {
+public:
+  TaskQueues(size_t nqueue) : queues_(nqueue), locks_(new mutex[nqueue]) { }
+
+  // Deal tasks in order, round robin.
+  void deal(const vector<TreeInput::Task> &tasks) {
+    for(size_t i = 0; i < tasks.size(); ++i) queues_[i % queues_.size()].push_back(tasks[i]);
+  }
+
+  // Take the front of queue i, or else the back of another one.
+  TreeInput::Task pop(size_t i, size_t nfilename) {
+    size_t nqueue = queues_.size();
+    for(size_t k = 0; k < nqueue; ++k) {
+      size_t j = (i + k) % nqueue;
+      lock_guard<mutex> guard(locks_[j]);
+      deque<TreeInput::Task> &queue = queues_[j];
+      if(queue.empty()) continue;
+      TreeInput::Task task;
+      if(k == 0) task = queue.front(), queue.pop_front();
+      else task = queue.back(), queue.pop_back();
+      return task;
+    }
+    return { nfilename, 0, 0 };
+  }
+
+private:
+  vector<deque<TreeInput::Task>> queues_;
+  unique_ptr<mutex[]> locks_;
+};
+
+// Cut files into ranges of whole clusters of about target entries, largest first.
+// Unscanned or empty files make whole-file tasks, so that they are reported as usual.
+static vector<TreeInput::Task> make_tasks(const TreeInput &input, size_t target)
+{
+  vector<TreeInput::Task> tasks;
+  for(size_t i = 0; i < input.get_nfilename(); ++i) {
+    if(input.get_file_problem(i)) continue;
+    vector<size_t> clusters = input.get_file_clusters(i);
+    if(clusters.size() < 2) { tasks.push_back({ i, 0, (size_t)-1 }); continue; }
+    size_t begin = 0;
+    for(size_t j = 1; j < clusters.size(); ++j) {
+      if(clusters[j] - begin < target && j + 1 < clusters.size()) continue;
+      tasks.push_back({ i, begin, j + 1 < clusters.size() ? clusters[j] : (size_t)-1 });
+      begin = clusters[j];
+    }
+  }
+  auto size = [&input](const TreeInput::Task &task) { return min(task.end, input.get_file_nentry(task.ifilename)) - task.begin; };
+  stable_sort(tasks.begin(), tasks.end(), [&size](const TreeInput::Task &a, const TreeInput::Task &b) {
+    return size(a) > size(b);
+  });
+  return tasks;
+}
+
+ParallelLoop::ParallelLoop(TreeInput *master, function<TreeInput *()> factory, size_t nthread)
+  : master_(master), factory_(std::move(factory)), nthread_(nthread), split_files_(true)
+{
+  if(nthread_ == 0) nthread_ = thread::hardware_concurrency();
+  if(nthread_ == 0) nthread_ = 1;
+}
+
+void ParallelLoop::loop()
+{
+  if(nthread_ == 1) { master_->loop(); return; }
+  ROOT::EnableThreadSafety();
+
+  // Build worker chains in the calling thread, where ROOT objects are created.
+  size_t nfilename = master_->get_nfilename();
+  vector<unique_ptr<TreeInput>> workers;
+  for(size_t i = 1; i < nthread_; ++i) {
+    TreeInput *worker = factory_();
+    for(size_t j = 0; j < nfilename; ++j) worker->add_filename(master_->get_filename(j));
+    vector<EventViewer *> master_tree = MultiStep::get_tree(master_);
+    vector<EventViewer *> worker_tree = MultiStep::get_tree(worker);
+    for(size_t j = 0; j < worker_tree.size(); ++j) {
+      EventViewer *viewer = worker_tree[j];
+      HistOutput *hist = dynamic_cast<HistOutput *>(viewer);
+      if(hist) hist->set_filename(nullptr);  // Only the master saves.
+      // Sketches binned alike merge exactly, whichever chain fills first.
+      HistOutput *master_hist = j < master_tree.size() ? dynamic_cast<HistOutput *>(master_tree[j]) : nullptr;
+      if(hist && master_hist) hist->share_sketch(*master_hist);
+      CutScan *scan = dynamic_cast<CutScan *>(viewer);
+      if(scan) scan->set_filename(nullptr);
+    }
+    worker->set_profile_summary(false);
+    worker->share_progress(*master_);
+    worker->share_plan(*master_);
+    workers.emplace_back(worker);
+  }
+
+  // Files are handed to whichever chain asks first, whole or split into tasks.
+  atomic<size_t> cursor(0);
+  TaskQueues queues(nthread_);
+  if(split_files_) {
+    if(!master_->is_scanned()) master_->scan_files(nthread_);
+    size_t nentry = 0;
+    for(size_t i = 0; i < nfilename; ++i) nentry += master_->get_file_nentry(i);
+    // A few tasks per chain, so that stealing can even out the end.
+    vector<TreeInput::Task> tasks = make_tasks(*master_, max(nentry / (nthread_ * 4), (size_t)1));
+    clog << "Info: split " << nfilename << " files into " << tasks.size() << " tasks" << endl;
+    queues.deal(tasks);
+    master_->set_task_dispatcher([&queues, nfilename]() { return queues.pop(0, nfilename); });
+    for(size_t i = 0; i < workers.size(); ++i) {
+      workers[i]->set_task_dispatcher([&queues, nfilename, i]() { return queues.pop(i + 1, nfilename); });
+    }
+  } else {
+    auto dispatcher = [&cursor]() -> size_t { return cursor++; };
+    master_->set_dispatcher(dispatcher);
+    for(const auto &worker : workers) worker->set_dispatcher(dispatcher);
+  }
+
+  // Counters are summarized once merged.
+  master_->set_profile_summary(false);
+  vector<thread> threads;
+  for(const auto &worker : workers) {
+    TreeInput *input = worker.get();
+    threads.emplace_back([input]() { input->loop(); });
+  }
+  master_->loop();
+  for(thread &t : threads) t.join();
+  master_->set_dispatcher(nullptr);
+  master_->set_task_dispatcher(nullptr);
+
+  for(const auto &worker : workers) {
+    master_->merge(*worker);
+    merge_chain(master_, worker.get());
+  }
+  master_->set_profile_summary(true);
+  if(EventViewer::get_profiling()) master_->print_profile();
+}
@@ -0,0 +1,139 @@
+#include "SkimOutput.h"
+#include "TreeInput.h"
+#include "fs.h"
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <iostream>
+
+using namespace std;
+
+const char SkimOutput::MAGIC[8] = { 'H', 'S', 'S', 'S', 'K', 'I', 'M', '3' };
+const char SkimOutput::SUFFIX[] = ".skim";
+
+class SkimOutput::Detail {
+public:
+  size_t ifilename;  // -1 if nothing collected
+  vector<vector<char>> data;
+  vector<vector<uint64_t>> offsets;  // in elements
+  vector<size_t> elem_size;
+  vector<size_t> nelem_max;
+  vector<char> type;
+};
+
+SkimOutput::SkimOutput(TreeInput *input, const char *dirpath)
+  : input_(input), dirpath_(strdup(dirpath))
+{
+  detail_ = new Detail;
+  detail_->ifilename = -1;
+}
+
+SkimOutput::~SkimOutput()
+{
+  flush();
+  delete detail_;
+  free(dirpath_);
+}
+
+bool SkimOutput::process()
+{
+  size_t ifilename = input_->get_ifilename();
+  size_t nbranch = input_->get_nbranch();
+  if(ifilename != detail_->ifilename) {
+    flush();
+    detail_->ifilename = ifilename;
+    detail_->data.assign(nbranch, { });
+    detail_->offsets.assign(nbranch, { 0 });
+    detail_->elem_size.resize(nbranch);
+    detail_->nelem_max.resize(nbranch);
+    detail_->type.resize(nbranch);
+    for(size_t i = 0; i < nbranch; ++i) {
+      detail_->elem_size[i] = input_->get_branch_elem_size(i);
+      detail_->nelem_max[i] = input_->get_branch_nelem_max(i);
+      detail_->type[i] = input_->get_branch_type(i);
+    }
+  }
+
+  for(size_t i = 0; i < nbranch; ++i) {
+    size_t nelem;
+    const char *data = (const char *)input_->get_branch_data(i, &nelem);
+    if(!data) nelem = 0;
+    detail_->data[i].insert(detail_->data[i].end(), data, data + nelem * detail_->elem_size[i]);
+    detail_->offsets[i].push_back(detail_->offsets[i].back() + nelem);
+  }
+  return true;
+}
+
+bool SkimOutput::flush()
+{
+  if(detail_->ifilename == (size_t)-1) return true;
+  string filename = string(dirpath_) + "/" + basename(input_->get_filename(detail_->ifilename)) + SUFFIX;
+  detail_->ifilename = -1;
+  size_t nbranch = detail_->data.size();
+  uint64_t nevent = nbranch ? detail_->offsets[0].size() - 1 : 0;
+
+  // Compute column positions.
+  size_t header_size = sizeof MAGIC + 2 * sizeof(uint64_t);
+  for(size_t i = 0; i < nbranch; ++i) {
+    header_size += 5 * sizeof(uint64_t) + strlen(input_->get_branch(i));
+  }
+  auto align = [](uint64_t pos) { return (pos + 63) / 64 * 64; };
+  vector<uint64_t> columns(nbranch);
+  uint64_t pos = align(header_size);
+  for(size_t i = 0; i < nbranch; ++i) {
+    columns[i] = pos;
+    pos = align(pos + detail_->offsets[i].size() * sizeof(uint64_t) + detail_->data[i].size());
+  }
+
+  // Write to a temporary file first, so that no partial skim is left.
+  string tmpname = filename + ".tmp";
+  FILE *file = fopen(tmpname.c_str(), "wb");
+  if(file == NULL) {
+    cerr << "Warning: failed to write skim file " << filename << ": " << strerror(errno) << endl;
+    return false;
+  }
+  shared_ptr<FILE> file_guard(file, [](FILE *f) { fclose(f); });
+  bool ok = true;
+  auto write = [file, &ok](const void *data, size_t size) {
+    ok = ok && fwrite(data, 1, size, file) == size;
+  };
+  auto write_u64 = [&write](uint64_t value) { write(&value, sizeof value); };
+  auto pad = [file, &ok](uint64_t target) {
+    long cur = ftell(file);
+    ok = ok && cur >= 0;
+    for(uint64_t n = ok ? target - cur : 0; n; --n) ok = ok && fputc(0, file) != EOF;
+  };
+
+  write(MAGIC, sizeof MAGIC);
+  write_u64(nbranch);
+  write_u64(nevent);
+  for(size_t i = 0; i < nbranch; ++i) {
+    const char *name = input_->get_branch(i);
+    write_u64(strlen(name));
+    write(name, strlen(name));
+    write_u64(detail_->type[i]);
+    write_u64(detail_->elem_size[i]);
+    write_u64(detail_->nelem_max[i]);
+    write_u64(columns[i]);
+  }
+  for(size_t i = 0; i < nbranch; ++i) {
+    pad(columns[i]);
+    write(detail_->offsets[i].data(), detail_->offsets[i].size() * sizeof(uint64_t));
+    write(detail_->data[i].data(), detail_->data[i].size());
+  }
+  ok = ok && fflush(file) == 0;
+  detail_->data.clear();
+  detail_->offsets.clear();
+  if(!ok || rename(tmpname.c_str(), filename.c_str())) {
+    cerr << "Warning: failed to write skim file " << filename << ": " << strerror(errno) << endl;
+    remove(tmpname.c_str());
+    return false;
+  }
+  clog << "Info: skimmed " << nevent << " events: " << filename << endl;
+  return true;
+}
@@ -1,19 +1,38 @@
 #include "TreeInput.h"
+#include "Hasher.h"
+#include "fs.h"
+#include "SkimOutput.h"
 #include <TFile.h>
 #include <TTree.h>
 #include <TBranch.h>
 #include <TLeaf.h>
 #include <TDataType.h>
+#include <TClass.h>
+#include <TVirtualCollectionProxy.h>
 #include <TObjArray.h>
+#include <TTreeCache.h>
+#include <TROOT.h>
+#include <yaml-cpp/yaml.h>
 #include <memory>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <vector>
 #include <string>
 #include <iostream>
+#include <fstream>
 #include <utility>
 #include <algorithm>
 #include <functional>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 using namespace std;
 
@@ -31,42 +50,792 @@ static bool expand_buffer_init(void *&buf, size_t &bufsiz, size_t maxsiz, size_t
   return true;
 }
 
+namespace {
+
+struct BranchLeaf {
+  string name;
+  char type;
+  size_t offset;
+};
+
+}  // namespace
+
+static char get_type_code(EDataType e)
+{
+  switch(e) {
+    case kFloat_t: case kFloat16_t: return 'F';
+    case kDouble_t: case kDouble32_t: return 'D';
+    case kInt_t: return 'I';
+    case kUInt_t: return 'i';
+    case kLong_t: case kLong64_t: return 'L';
+    case kULong_t: case kULong64_t: return 'l';
+    case kShort_t: return 'S';
+    case kUShort_t: return 's';
+    case kChar_t: return 'B';
+    case kUChar_t: return 'b';
+    case kBool_t: return 'O';
+    default: return 0;
+  }
+}
+
+static char get_type_code(const char *type_name)
+{
+  static const pair<const char *, char> codes[] = {
+    { "Float_t", 'F' }, { "Float16_t", 'F' }, { "Double_t", 'D' }, { "Double32_t", 'D' },
+    { "Int_t", 'I' }, { "UInt_t", 'i' }, { "Long64_t", 'L' }, { "Long_t", 'L' },
+    { "ULong64_t", 'l' }, { "ULong_t", 'l' }, { "Short_t", 'S' }, { "UShort_t", 's' },
+    { "Char_t", 'B' }, { "UChar_t", 'b' }, { "Bool_t", 'O' },
+  };
+  for(const auto &code : codes) if(strcmp(code.first, type_name) == 0) return code.second;
+  return 0;
+}
+
+static size_t get_type_size(char type)
+{
+  switch(type) {
+    case 'F': case 'I': case 'i': return 4;
+    case 'D': case 'L': case 'l': return 8;
+    case 'S': case 's': return 2;
+    case 'B': case 'b': case 'O': return 1;
+    default: return 0;
+  }
+}
+
+// Memory layout of a branch as bound to a buffer by SetAddress().
+// Class objects, split or not, are referenced by a pointer. Leaves of a
+// multi-leaf branch are laid out at their offsets; if all are of one type,
+// they read as an array of it, else as one opaque element.
+struct BranchLayout {
+  size_t elem_size, nelem_max;  // 0 if unsupported
+  char type;  // 0 for class objects and mixed leaves
+  vector<BranchLeaf> leaves;
+  TVirtualCollectionProxy *proxy;  // of std::vector objects of fundamental type
+  char span_type;
+};
+
+static BranchLayout get_branch_layout(TBranch *branch)
+{
+  BranchLayout layout = { 0, 0, 0, { }, nullptr, 0 };
+  TClass *c; EDataType e;
+  if(branch->GetExpectedType(c, e)) return layout;
+  if(c) {
+    layout.elem_size = sizeof(void *);
+    layout.nelem_max = 1;
+    TVirtualCollectionProxy *proxy = c->GetCollectionProxy();
+    if(proxy && proxy->GetCollectionType() == ROOT::kSTLvector && !proxy->GetValueClass()) {
+      char type = get_type_code(proxy->GetType());
+      if(type && type != 'O') layout.proxy = proxy, layout.span_type = type;  // vector<bool> is not contiguous.
+    }
+    return layout;
+  }
+
+  TObjArray *leaves = branch->GetListOfLeaves();
+  size_t nleaf = leaves->GetEntries();
+  if(nleaf == 1) {
+    TLeaf *leaf = (TLeaf *)leaves->UncheckedAt(0);
+    Int_t count = 0;
+    TLeaf *leafcnt = leaf->GetLeafCounter(count);
+    if(leafcnt) count = leafcnt->GetMaximum();
+    layout.type = layout.span_type = get_type_code(e);
+    layout.elem_size = TDataType::GetDataType(e)->Size();
+    layout.nelem_max = max(count, (Int_t)0);
+    layout.leaves.push_back({ leaf->GetName(), layout.type, 0 });
+    return layout;
+  }
+
+  // Variable-length leaves would move others, so only fixed ones are supported.
+  size_t size = 0;
+  bool uniform = nleaf > 0;
+  for(size_t j = 0; j < nleaf; ++j) {
+    TLeaf *leaf = (TLeaf *)leaves->UncheckedAt(j);
+    Int_t count = 0;
+    if(leaf->GetLeafCounter(count)) return layout;
+    char type = get_type_code(leaf->GetTypeName());
+    if(!type) return layout;
+    layout.leaves.push_back({ leaf->GetName(), type, (size_t)leaf->GetOffset() });
+    size = max(size, (size_t)leaf->GetOffset() + get_type_size(type) * leaf->GetLen());
+    uniform = uniform && type == layout.leaves[0].type;
+  }
+  if(uniform) {
+    layout.type = layout.span_type = layout.leaves[0].type;
+    layout.elem_size = get_type_size(layout.type);
+    layout.nelem_max = size / layout.elem_size;
+  } else {
+    layout.elem_size = size;
+    layout.nelem_max = size ? 1 : 0;
+  }
+  return layout;
+}
+
 class TreeInput::Detail {
 public:
+  // A file opened ahead of reading, possibly on a helper thread.
+  struct OpenedFile {
+    unique_ptr<TFile> file;
+    TTree *tree;
+  };
+
+  // Memory-mapped skim file, see SkimOutput.h for the layout.
+  struct Skim {
+    void *map;
+    size_t size;
+    size_t nevent;
+    vector<const uint64_t *> offsets;  // per requested branch
+    vector<const char *> data;
+    vector<const char *> current;  // data of the entry last read
+    Skim() : map(MAP_FAILED), size(0), nevent(0) { }
+    ~Skim() { if(map != MAP_FAILED) munmap(map, size); }
+  };
+  static const size_t SKIM_CLUSTER = 65536;
+
+  // Typed views of requested branches, see add_branch<T>().
+  // A view aliases branch data of the wanted type, or else a buffer holding
+  // the data converted after every read of the branch.
+  struct View {
+    size_t ibranch;
+    char type;
+    size_t elem_size;
+    vector<uint64_t> buffer;  // 8-byte aligned
+    void *data;  // nullptr until a file is opened
+  };
+
+  // Progress shared by inputs reading the same files in parallel.
+  struct Progress {
+    chrono::steady_clock::time_point start;
+    int64_t interval;  // in nanoseconds
+    size_t nfile;
+    atomic<size_t> nevent_total;  // 0 if unknown, less entries passed over
+    atomic<size_t> nevent, nbyte, nfile_started;
+    atomic<int64_t> last_report;  // nanoseconds since start
+  };
+
+  // All state below belongs to the thread running the input, except the
+  // dispatchers and progress, which may be shared with inputs in parallel.
+  const TreeInput *input;  // owning this
+
+  // File sources and current position.
   vector<string> filenames;
   size_t ifilename;  // index into filenames
   size_t local_index;  // -1 if not opened
   size_t global_index;  // <total events read> if at the end
   unique_ptr<TFile> file;
   TTree *tree;
+  unique_ptr<Skim> skim;  // instead of file and tree for skim files
+  size_t range_begin, range_end;  // set_entry_range()
+  size_t entry_begin, entry_end;  // range of current file, clipped to its entries
+
+  // Requested branches, by index, and their buffers.
   vector<string> branch_names;
+  vector<bool> branch_lazy;
+  vector<Long64_t> branch_entry;  // entry held by buffer, -1 if none
   vector<TBranch *> branches;
   vector<unique_ptr<void, function<void(void *)>>> branch_data;
   vector<size_t> branch_data_capacity;
   vector<size_t> branch_current_size;
   vector<size_t> branch_elem_size;
   vector<size_t> branch_nelem_max;
+  vector<char> branch_type;
+  vector<vector<BranchLeaf>> branch_leaves;
+  // For std::vector branches of fundamental types, a proxy of this input to
+  // find the elements of the vector object read.
+  vector<unique_ptr<TVirtualCollectionProxy>> branch_proxy;
+  vector<char> branch_span_type;
+  deque<View> views;  // stable addresses for handles
+  vector<bool> branch_convert;  // per requested branch, some view converts
+
+  // Columnar batch of next_batch().
+  size_t batch_size;
+  vector<vector<char>> batch_data;
+  vector<vector<size_t>> batch_offsets;  // in elements
+
+  // Files handed out, by shared dispatchers if set, and opened ahead.
+  function<size_t()> dispatcher;
+  function<Task()> task_dispatcher;
+  size_t iclaimed;  // last file index handed out
+  size_t prefetch_depth;
+  deque<pair<Task, future<OpenedFile>>> prefetches;
+
+  // Read cache and I/O counters.
+  bool cache_enabled;
+  size_t cache_size;
+  size_t cache_learn_entries;
+  IOStats io_stats;  // of closed files
+  chrono::steady_clock::time_point file_start;  // opening of current file
+
+  // Entries, compressed bytes of requested branches and cluster boundaries
+  // per file, from scan_files().
+  vector<size_t> file_nentry, file_zip_bytes;
+  vector<vector<size_t>> file_clusters;
+  // Problems found per file, empty if none, and buffer bytes and elements
+  // needed per requested branch, empty for skim files.
+  vector<string> file_problems;
+  vector<vector<size_t>> file_branch_bytes, file_branch_nelem;
+  bool planned;
+
+  // Progress reporting, shared with inputs in parallel.
+  shared_ptr<Progress> progress;
+  size_t progress_nevent, progress_nbyte;  // of current file, already counted
+
+  // Returns a task with ifilename = nfilename if no file is left.
+  // Files with problems found by planning or unwanted by the input are
+  // passed over, so that they are neither opened nor prefetched.
+  Task claim_task(size_t nfilename) {
+    for(;;) {
+      if(iclaimed + 1 > nfilename) return { nfilename, 0, 0 };
+      Task task = { 0, range_begin, range_end };
+      if(task_dispatcher) task = task_dispatcher();
+      else task.ifilename = dispatcher ? dispatcher() : iclaimed + 1;
+      size_t i = iclaimed = task.ifilename = min(task.ifilename, nfilename);
+      if(i == nfilename) return task;
+      bool problem = planned && !file_problems[i].empty();
+      if(!problem && input->want_file(i, filenames[i].c_str())) return task;
+      if(!problem && task.begin == 0) clog << "Info: skipping file: " << filenames[i] << endl;
+      if(progress && task.begin == 0) ++progress->nfile_started;
+      drop_progress(task);
+    }
+  }
+
+  // Open a file and locate the tree.
+  // Baskets of warm_branches covering the first entry of the file are decompressed in advance.
+  static OpenedFile open_file(const string &filename, const string &treename,
+      const vector<string> &warm_branches) {
+    OpenedFile opened = { unique_ptr<TFile>(new TFile(filename.c_str())), nullptr };
+    if(!opened.file->IsOpen()) return opened;
+    opened.tree = dynamic_cast<TTree *>(opened.file->Get(treename.c_str()));
+    if(!opened.tree) return opened;
+    for(const string &name : warm_branches) {
+      TBranch *branch = opened.tree->GetBranch(name.c_str());
+      if(branch) branch->GetBasket(0);
+    }
+    return opened;
+  }
+
+  // Keep up to prefetch_depth upcoming files opening on helper threads.
+  void fill_prefetches(const char *treename) {
+    while(prefetches.size() < prefetch_depth) {
+      Task task = claim_task(filenames.size());
+      size_t i = task.ifilename;
+      if(i == filenames.size()) break;
+      if(is_skim(filenames[i].c_str())) { prefetches.emplace_back(task, future<OpenedFile>()); continue; }
+      vector<string> warm_branches;
+      for(size_t j = 0; task.begin == 0 && j < branch_names.size(); ++j) {
+        if(!branch_lazy[j]) warm_branches.push_back(branch_names[j]);
+      }
+      prefetches.emplace_back(task, async(launch::async, open_file, filenames[i], string(treename), warm_branches));
+    }
+  }
+
+  // Count events and bytes read so far from current file, and report if due.
+  // Called every few thousand events, so that the clock is rarely looked at.
+  void publish_progress(size_t nread) {
+    Progress &p = *progress;
+    p.nevent += nread - progress_nevent;
+    progress_nevent = nread;
+    size_t nbyte = file ? file->GetBytesRead() : 0;
+    p.nbyte += nbyte - progress_nbyte;
+    progress_nbyte = nbyte;
+
+    int64_t elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - p.start).count();
+    int64_t last = p.last_report;
+    if(elapsed - last < p.interval || !p.last_report.compare_exchange_strong(last, elapsed)) return;
+    double seconds = elapsed * 1e-9;
+    size_t nevent = p.nevent, nstarted = p.nfile_started, nevent_total = p.nevent_total;
+    double rate = nevent / seconds;
+    clog << "Info: progress: " << nevent;
+    if(nevent_total) clog << "/" << nevent_total << " events (" << 100.0 * nevent / nevent_total << "%)";
+    else clog << " events";
+    clog << ", " << rate << " events/s, " << p.nbyte / seconds / 1e6 << " MB/s, "
+         << p.nfile - min(nstarted, p.nfile) << "/" << p.nfile << " files left";
+    if(nevent_total && rate > 0.0) {
+      size_t eta = max((double)nevent_total - nevent, 0.0) / rate;
+      char buf[32];
+      snprintf(buf, sizeof buf, "%zu:%02zu:%02zu", eta / 3600, eta / 60 % 60, eta % 60);
+      clog << ", ETA " << buf;
+    }
+    clog << endl;
+  }
+
+  void set_progress_totals() {
+    if(!progress) return;
+    progress->nfile = filenames.size();
+    size_t nevent_total = 0;
+    for(size_t nentry : file_nentry) nevent_total += nentry;
+    progress->nevent_total = nevent_total;
+  }
+
+  // Take entries of a task passed over out of the progress total, so that
+  // percentage and ETA only cover entries to be read.
+  void drop_progress(const Task &task) {
+    if(!progress || task.ifilename >= file_nentry.size()) return;
+    size_t nentry = file_nentry[task.ifilename];
+    size_t ndrop = min(task.end, nentry) - min(task.begin, nentry);
+    size_t total = progress->nevent_total;
+    while(!progress->nevent_total.compare_exchange_weak(total, total - min(ndrop, total)));
+  }
+
+  // Fill file_nentry[i] and file_zip_bytes[i], leaving 0 for unreadable files,
+  // and check requested branches as next() would when opening the file.
+  void scan_file(size_t i, const char *treename) {
+    const char *filename = filenames[i].c_str();
+    if(is_skim(filename)) {
+      uint64_t header[3];  // magic, nbranch, nevent
+      ifstream ifs(filename, ios::binary);
+      if(!ifs.read((char *)header, sizeof header) || memcmp(header, SkimOutput::MAGIC, sizeof header[0])) {
+        file_problems[i] = "bad skim header";
+        return;
+      }
+      file_nentry[i] = header[2];
+      file_zip_bytes[i] = Stat(filename).size();
+      // Columns split anywhere; pretend clusters of fixed size.
+      for(size_t entry = 0; entry < header[2]; entry += SKIM_CLUSTER) file_clusters[i].push_back(entry);
+      file_clusters[i].push_back(header[2]);
+      return;
+    }
+    unique_ptr<TFile> scanned(new TFile(filename));
+    if(!scanned->IsOpen()) {
+      file_problems[i] = "broken file";
+      return;
+    }
+    TTree *scanned_tree = dynamic_cast<TTree *>(scanned->Get(treename));
+    if(!scanned_tree) {
+      file_problems[i] = string("no tree ") + treename;
+      return;
+    }
+    file_nentry[i] = scanned_tree->GetEntries();
+    size_t zip_bytes = 0;
+    vector<char> types;
+    for(const string &name : branch_names) {
+      TBranch *branch = scanned_tree->GetBranch(name.c_str());
+      if(!branch) {
+        if(file_problems[i].empty()) file_problems[i] = "missing branch " + name;
+        continue;
+      }
+      zip_bytes += branch->GetZipBytes("*");
+      BranchLayout layout = get_branch_layout(branch);
+      if((layout.elem_size == 0 || layout.nelem_max == 0) && file_problems[i].empty()) {
+        file_problems[i] = "unsupported branch " + name;
+      }
+      file_branch_bytes[i].push_back(layout.elem_size * layout.nelem_max);
+      file_branch_nelem[i].push_back(layout.nelem_max);
+      types.push_back(layout.type);
+    }
+    for(const View &view : views) {
+      if(file_problems[i].empty() && view.ibranch < types.size() && !is_numeric_type(types[view.ibranch])) {
+        file_problems[i] = "branch " + branch_names[view.ibranch] + " not convertible to " + view.type;
+      }
+    }
+    file_zip_bytes[i] = branch_names.empty() ? scanned_tree->GetZipBytes() : zip_bytes;
+    Long64_t nentry = file_nentry[i];
+    TTree::TClusterIterator cluster = scanned_tree->GetClusterIterator(0);
+    for(Long64_t start; (start = cluster.Next()) < nentry;) file_clusters[i].push_back(start);
+    file_clusters[i].push_back(nentry);
+  }
+
+  // Allocate branch buffers and converting views once, at their largest
+  // over all files, so that opening files never reallocates them.
+  size_t allocate_planned() {
+    size_t total = 0;
+    for(size_t j = 0; j < branch_names.size(); ++j) {
+      size_t bytes = 0, nelem = 0;
+      for(size_t i = 0; i < filenames.size(); ++i) {
+        if(!file_problems[i].empty() || j >= file_branch_bytes[i].size()) continue;
+        bytes = max(bytes, file_branch_bytes[i][j]);
+        nelem = max(nelem, file_branch_nelem[i][j]);
+      }
+      if(!bind_buffer(j, bytes)) return -1;
+      total += branch_data_capacity[j];
+      for(View &view : views) {
+        if(view.ibranch == j) view.buffer.reserve((nelem * view.elem_size + 7) / 8);
+      }
+    }
+    return total;
+  }
+
+  // Pass over files with problems from now on and allocate for the others.
+  // Returns the number of files with problems.
+  size_t apply_plan() {
+    size_t nproblem = count_if(file_problems.begin(), file_problems.end(), [](const string &p) { return !p.empty(); });
+    size_t nbyte = allocate_planned();
+    planned = nbyte != (size_t)-1;
+    if(!planned) cerr << "Warning: failed to allocate planned branch buffers" << endl;
+    else clog << "Info: planned " << filenames.size() - nproblem << " of " << filenames.size()
+              << " files, " << nbyte << " bytes of branch buffers" << endl;
+    return nproblem;
+  }
+
+  // Plans are cached in YAML under key, a hash of what they depend on.
+  bool load_plan(const char *path, const string &key) {
+    if(!Stat(path).isreg()) return false;
+    try {
+      YAML::Node node = YAML::LoadFile(path);
+      if(node["key"].as<string>() != key || node["files"].size() != filenames.size()) return false;
+      size_t i = 0;
+      for(const YAML::Node &file_node : node["files"]) {
+        file_nentry[i] = file_node["nentry"].as<size_t>();
+        file_zip_bytes[i] = file_node["zip_bytes"].as<size_t>();
+        file_clusters[i] = file_node["clusters"].as<vector<size_t>>();
+        file_problems[i] = file_node["problem"].as<string>();
+        file_branch_bytes[i] = file_node["branch_bytes"].as<vector<size_t>>();
+        file_branch_nelem[i] = file_node["branch_nelem"].as<vector<size_t>>();
+        ++i;
+      }
+    } catch(const YAML::Exception &e) {
+      cerr << "Warning: ignoring broken plan " << path << ": " << e.what() << endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool save_plan(const char *path, const string &key) const {
+    YAML::Node node;
+    node["key"] = key;
+    for(size_t i = 0; i < filenames.size(); ++i) {
+      YAML::Node file_node;
+      file_node["path"] = filenames[i];
+      file_node["nentry"] = file_nentry[i];
+      file_node["zip_bytes"] = file_zip_bytes[i];
+      file_node["clusters"] = file_clusters[i];
+      file_node["problem"] = file_problems[i];
+      file_node["branch_bytes"] = file_branch_bytes[i];
+      file_node["branch_nelem"] = file_branch_nelem[i];
+      node["files"].push_back(file_node);
+    }
+
+    // Write to a temporary file first, so that no partial plan is left.
+    string tmpname = string(path) + ".tmp";
+    {
+      ofstream ofs(tmpname);
+      ofs << YAML::Dump(node) << endl;
+      if(!ofs) return false;
+    }
+    return rename(tmpname.c_str(), path) == 0;
+  }
+
+  void reset_scan() {
+    file_nentry.assign(filenames.size(), 0);
+    file_zip_bytes.assign(filenames.size(), 0);
+    file_clusters.assign(filenames.size(), { });
+    file_problems.assign(filenames.size(), string());
+    file_branch_bytes.assign(filenames.size(), { });
+    file_branch_nelem.assign(filenames.size(), { });
+  }
+
+  // Append current event to batch buffers.
+  void append_batch() {
+    for(size_t i = 0; i < branch_current_size.size(); ++i) {
+      if(branch_lazy[i] && !load_branch(i)) branch_current_size[i] = 0;
+      const char *data = (const char *)get_data(i);
+      batch_data[i].insert(batch_data[i].end(), data, data + branch_current_size[i]);
+      batch_offsets[i].push_back(batch_offsets[i].back() + branch_current_size[i] / branch_elem_size[i]);
+    }
+    ++batch_size;
+  }
+
+  // Expand buffer of requested branch i to hold max_size bytes.
+  bool bind_buffer(size_t i, size_t max_size) {
+    if(branch_data.size() <= i) {
+      branch_data.emplace_back(nullptr, [](void *p) { free(p); });
+      branch_data_capacity.emplace_back(0);
+    }
+    void *buf = branch_data[i].get();
+    if(!expand_buffer_init(buf, branch_data_capacity[i], max_size, sizeof(void *))) return false;
+    branch_data[i].release();
+    branch_data[i].reset(buf);
+    return true;
+  }
+
+  static bool is_skim(const char *filename) {
+    size_t len = strlen(filename), suffix_len = strlen(SkimOutput::SUFFIX);
+    return len >= suffix_len && strcmp(filename + len - suffix_len, SkimOutput::SUFFIX) == 0;
+  }
+
+  // Map a skim file and bind requested branches to it.
+  // Returns an error message, empty on success.
+  string open_skim(const char *filename) {
+    unique_ptr<Skim> newskim(new Skim);
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) return string("open: ") + strerror(errno);
+    newskim->size = Stat(filename).size();
+    if(newskim->size) newskim->map = mmap(nullptr, newskim->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    close(fd);
+    if(newskim->map == MAP_FAILED) return string("mmap: ") + strerror(err);
+    madvise(newskim->map, newskim->size, MADV_SEQUENTIAL);
+
+    // Parse header.
+    const char *base = (const char *)newskim->map;
+    size_t pos = 0;
+    auto read_u64 = [&](uint64_t &value) {
+      if(pos + sizeof value > newskim->size) return false;
+      memcpy(&value, base + pos, sizeof value);
+      pos += sizeof value;
+      return true;
+    };
+    uint64_t magic, nbranch, nevent;
+    if(!read_u64(magic) || memcmp(&magic, SkimOutput::MAGIC, sizeof magic)) return "bad magic";
+    if(!read_u64(nbranch) || !read_u64(nevent)) return "truncated header";
+    if(nevent >= newskim->size / sizeof(uint64_t)) return "truncated header";
+    newskim->nevent = nevent;
+    newskim->offsets.assign(branch_names.size(), nullptr);
+    newskim->data.assign(branch_names.size(), nullptr);
+    vector<size_t> elem_sizes(branch_names.size()), nelem_maxes(branch_names.size());
+    vector<char> types(branch_names.size());
+    for(uint64_t ibranch = 0; ibranch < nbranch; ++ibranch) {
+      uint64_t name_len, type, elem_size, nelem_max, column;
+      if(!read_u64(name_len) || pos + name_len > newskim->size) return "truncated header";
+      string name(base + pos, name_len);
+      pos += name_len;
+      if(!read_u64(type) || !read_u64(elem_size) || !read_u64(nelem_max) || !read_u64(column)) return "truncated header";
+      auto iter = find(branch_names.begin(), branch_names.end(), name);
+      if(iter == branch_names.end()) continue;
+      size_t i = iter - branch_names.begin();
+      size_t offsets_size = (nevent + 1) * sizeof(uint64_t);
+      if(column + offsets_size > newskim->size) return "truncated column " + name;
+      const uint64_t *offsets = (const uint64_t *)(base + column);
+      // Entries are read in place, so bound each by nelem_max, as a TTree would be.
+      if(offsets[0] != 0) return "corrupt offsets of " + name;
+      for(uint64_t entry = 0; entry < nevent; ++entry) {
+        if(offsets[entry + 1] < offsets[entry] || offsets[entry + 1] - offsets[entry] > nelem_max) {
+          return "corrupt offsets of " + name;
+        }
+      }
+      if(elem_size == 0 || offsets[nevent] > (newskim->size - column - offsets_size) / elem_size) {
+        return "truncated column " + name;
+      }
+      newskim->offsets[i] = offsets;
+      newskim->data[i] = base + column + offsets_size;
+      types[i] = type;
+      elem_sizes[i] = elem_size;
+      nelem_maxes[i] = nelem_max;
+    }
+
+    // Data are read in place; buffers are only kept for converting views.
+    for(size_t i = 0; i < branch_names.size(); ++i) {
+      if(!newskim->data[i]) return "missing branch " + branch_names[i];
+      if(!bind_buffer(i, 0)) return "unallocable branch " + branch_names[i];
+    }
+    newskim->current = newskim->data;
+    string error = bind_views(types, nelem_maxes);
+    if(!error.empty()) return error;
+    branches.clear();
+    branch_leaves.clear();
+    for(size_t i = 0; i < branch_names.size(); ++i) branch_leaves.push_back({ { branch_names[i], types[i], 0 } });
+    branch_proxy.clear();
+    branch_proxy.resize(branch_names.size());
+    branch_span_type = types;
+    branch_current_size.assign(branch_names.size(), 0);
+    branch_entry.assign(branch_names.size(), -1);
+    branch_elem_size = std::move(elem_sizes);
+    branch_nelem_max = std::move(nelem_maxes);
+    branch_type = std::move(types);
+    skim = std::move(newskim);
+    return "";
+  }
+
+  // Point views to the branches of a file being opened.
+  // Returns an error message, empty on success.
+  string bind_views(const vector<char> &types, const vector<size_t> &nelem_maxes) {
+    branch_convert.assign(branch_names.size(), false);
+    for(View &view : views) {
+      char type = types[view.ibranch];
+      if(!is_numeric_type(type)) {
+        return "branch " + branch_names[view.ibranch] + " not convertible to " + view.type;
+      }
+      if(type == view.type) {
+        view.data = branch_data[view.ibranch].get();  // skim entries repoint it on read
+      } else {
+        view.buffer.resize((nelem_maxes[view.ibranch] * view.elem_size + 7) / 8);
+        view.data = view.buffer.data();
+        branch_convert[view.ibranch] = true;
+      }
+    }
+    return "";
+  }
+
+  static bool is_numeric_type(char type) {
+    return type && strchr("FDIiLlSsBbO", type);
+  }
+
+  template<class Dst>
+  static void convert_to(char src_type, const void *src, size_t n, Dst *dst) {
+    switch(src_type) {
+      case 'F': copy_n((const float *)src, n, dst); break;
+      case 'D': copy_n((const double *)src, n, dst); break;
+      case 'I': copy_n((const int32_t *)src, n, dst); break;
+      case 'i': copy_n((const uint32_t *)src, n, dst); break;
+      case 'L': copy_n((const int64_t *)src, n, dst); break;
+      case 'l': copy_n((const uint64_t *)src, n, dst); break;
+      case 'S': copy_n((const int16_t *)src, n, dst); break;
+      case 's': copy_n((const uint16_t *)src, n, dst); break;
+      case 'B': copy_n((const int8_t *)src, n, dst); break;
+      case 'b': copy_n((const uint8_t *)src, n, dst); break;
+      case 'O': copy_n((const bool *)src, n, dst); break;
+    }
+  }
+
+  // Convert elements just read of branch i into its converting views.
+  void convert_views(size_t i) {
+    const void *src = get_data(i);
+    size_t n = branch_current_size[i] / branch_elem_size[i];
+    for(View &view : views) {
+      if(view.ibranch != i || view.data == src) continue;
+      char src_type = branch_type[i];
+      switch(view.type) {
+        case 'F': convert_to(src_type, src, n, (float *)view.data); break;
+        case 'D': convert_to(src_type, src, n, (double *)view.data); break;
+        case 'I': convert_to(src_type, src, n, (int32_t *)view.data); break;
+        case 'i': convert_to(src_type, src, n, (uint32_t *)view.data); break;
+        case 'L': convert_to(src_type, src, n, (int64_t *)view.data); break;
+        case 'l': convert_to(src_type, src, n, (uint64_t *)view.data); break;
+        case 'S': convert_to(src_type, src, n, (int16_t *)view.data); break;
+        case 's': convert_to(src_type, src, n, (uint16_t *)view.data); break;
+        case 'B': convert_to(src_type, src, n, (int8_t *)view.data); break;
+        case 'b': convert_to(src_type, src, n, (uint8_t *)view.data); break;
+        case 'O': convert_to(src_type, src, n, (bool *)view.data); break;
+      }
+    }
+  }
+
+  // Data of requested branch i as last read: in the mapping for skim files,
+  // else in its buffer.
+  const void *get_data(size_t i) const {
+    return skim ? (const void *)skim->current[i] : branch_data[i].get();
+  }
+
+  Int_t GetSkimBranchEntry(size_t i, Long64_t entry) {
+    const uint64_t *offsets = skim->offsets[i];
+    size_t size = (offsets[entry + 1] - offsets[entry]) * branch_elem_size[i];
+    skim->current[i] = skim->data[i] + offsets[entry] * branch_elem_size[i];
+    branch_current_size[i] = size;
+    branch_entry[i] = entry;
+    for(View &view : views) {
+      if(view.ibranch == i && view.type == branch_type[i]) view.data = (void *)skim->current[i];
+    }
+    if(branch_convert[i]) convert_views(i);
+    return size;
+  }
+
+  Int_t GetSkimEntry(Long64_t entry) {
+    if(entry < 0 || (size_t)entry >= skim->nevent) return 0;
+    Int_t total = 0;
+    for(size_t i = 0; i < branch_current_size.size(); ++i) {
+      if(!branch_lazy[i]) total += GetSkimBranchEntry(i, entry);
+    }
+    return max(total, (Int_t)1);  // Events may hold empty arrays only.
+  }
+
+  // Attach a TTreeCache holding the requested branches to current tree.
+  void setup_cache() {
+    if(!cache_enabled) { tree->SetCacheSize(0); return; }
+    Long64_t size = cache_size;
+    if(size == 0) {
+      // Compressed size of the requested branches within the first cluster.
+      Long64_t nentry = tree->GetEntries();
+      TTree::TClusterIterator cluster = tree->GetClusterIterator(0);
+      cluster.Next();
+      Long64_t cluster_nentry = min(max(cluster.GetNextEntry(), (Long64_t)1), max(nentry, (Long64_t)1));
+      for(size_t i = 0; i < branches.size(); ++i) {
+        if(branch_lazy[i]) continue;
+        size += branches[i]->GetZipBytes("*") * cluster_nentry / max(nentry, (Long64_t)1);
+      }
+      size = max(size * 2, (Long64_t)1 << 20);  // Room for basket misalignment.
+    }
+    tree->SetCacheSize(size);
+    for(size_t i = 0; i < branches.size(); ++i) {
+      if(!branch_lazy[i]) tree->AddBranchToCache(branches[i], true);
+    }
+    if(cache_learn_entries) tree->SetCacheLearnEntries(cache_learn_entries);
+    else tree->StopCacheLearningPhase();
+  }
+
+  // Collect I/O counters of current file.
+  IOStats get_file_io_stats() const {
+    IOStats stats = { };
+    if(!file) return stats;
+    stats.bytes_read = file->GetBytesRead();
+    stats.read_calls = file->GetReadCalls();
+    TFileCacheRead *cache = file->GetCacheRead(tree);
+    if(cache) {
+      stats.cache_hit_bytes = cache->GetBytesRead();
+      stats.cache_hit_calls = cache->GetReadCalls();
+      stats.cache_miss_bytes = cache->GetNoCacheBytesRead();
+      stats.cache_miss_calls = cache->GetNoCacheReadCalls();
+    }
+    return stats;
+  }
+
+  static void add_io_stats(IOStats &total, const IOStats &stats) {
+    total.bytes_read += stats.bytes_read;
+    total.read_calls += stats.read_calls;
+    total.cache_hit_bytes += stats.cache_hit_bytes;
+    total.cache_hit_calls += stats.cache_hit_calls;
+    total.cache_miss_bytes += stats.cache_miss_bytes;
+    total.cache_miss_calls += stats.cache_miss_calls;
+  }
 
   Int_t GetEntry(Long64_t entry) {
+    if(entry < 0 || (size_t)entry >= entry_end) return 0;
+    if(skim) return GetSkimEntry(entry);
     Int_t total = 0;
+    bool eager = false;
     for(size_t i = 0; i < branches.size(); ++i) {
+      if(branch_lazy[i]) continue;
+      eager = true;
       Int_t current = branches[i]->GetEntry(entry);
       if(current <= 0) return current;
-      branch_current_size[i] = current;
+      branch_current_size[i] = get_read_size(i, current);
+      branch_entry[i] = entry;
+      if(branch_convert[i]) convert_views(i);
       total += current;
     }
+    if(!eager) return entry >= 0 && entry < tree->GetEntries();
     return total;
   }
+
+  // Read lazy branch i at current entry if not yet.
+  bool load_branch(size_t i) {
+    Long64_t entry = local_index;
+    if(branch_entry[i] == entry) return true;
+    if(skim) return GetSkimBranchEntry(i, entry), true;
+    if(!tree) return false;
+    Int_t current = branches[i]->GetEntry(entry);
+    if(current <= 0) return false;
+    branch_current_size[i] = get_read_size(i, current);
+    branch_entry[i] = entry;
+    if(branch_convert[i]) convert_views(i);
+    return true;
+  }
+
+  // Bytes of the buffer filled by a read of CURRENT bytes. Those are the
+  // serialized size, which matches the buffer only for single leaves.
+  size_t get_read_size(size_t i, Int_t current) const {
+    return branch_leaves[i].size() == 1 ? current : branch_elem_size[i] * branch_nelem_max[i];
+  }
 };
 
 TreeInput::TreeInput(const char *name)
   : name_(strdup(name))
 {
   detail_ = new Detail;
+  detail_->input = this;
   detail_->ifilename = -1;
   detail_->local_index = -1;
   detail_->global_index = -1;
   detail_->tree = nullptr;
+  detail_->cache_enabled = true;
+  detail_->cache_size = 0;
+  detail_->cache_learn_entries = 0;
+  detail_->io_stats = { };
+  detail_->batch_size = 0;
+  detail_->iclaimed = -1;
+  detail_->range_begin = 0;
+  detail_->range_end = -1;
+  detail_->entry_begin = 0;
+  detail_->entry_end = -1;
+  detail_->prefetch_depth = 0;
+  detail_->progress_nevent = 0;
+  detail_->progress_nbyte = 0;
+  detail_->planned = false;
 }
 
 TreeInput::~TreeInput()
@@ -112,10 +881,18 @@ const char *TreeInput::get_filename(size_t i) const
   return i >= get_nfilename() ? nullptr : detail_->filenames[i].c_str();
 }
 
-size_t TreeInput::add_branch(const char *filename)
+size_t TreeInput::add_branch(const char *filename, bool lazy)
 {
+  // A branch requested again is shared, and eager if requested so once.
+  auto iter = find(detail_->branch_names.begin(), detail_->branch_names.end(), filename);
+  if(iter != detail_->branch_names.end()) {
+    size_t i = iter - detail_->branch_names.begin();
+    detail_->branch_lazy[i] = detail_->branch_lazy[i] && lazy;
+    return i;
+  }
   size_t i = detail_->branch_names.size();
   detail_->branch_names.push_back(filename);
+  detail_->branch_lazy.push_back(lazy);
   return i;
 }
 
@@ -129,36 +906,327 @@ const char *TreeInput::get_branch(size_t i) const
   return i >= get_nbranch() ? nullptr : detail_->branch_names[i].c_str();
 }
 
-void *TreeInput::get_branch_data(size_t i, size_t *nelem) const
+bool TreeInput::is_branch_lazy(size_t i) const
+{
+  return i >= get_nbranch() ? false : detail_->branch_lazy[i];
+}
+
+size_t TreeInput::add_view(const char *name, bool lazy, char type, size_t elem_size)
+{
+  size_t ibranch = add_branch(name, lazy);
+  deque<Detail::View> &views = detail_->views;
+  for(size_t k = 0; k < views.size(); ++k) {
+    if(views[k].ibranch == ibranch && views[k].type == type) return k;
+  }
+  views.push_back({ ibranch, type, elem_size, { }, nullptr });
+  return views.size() - 1;
+}
+
+void *const *TreeInput::get_view_slot(size_t iview) const
+{
+  return &detail_->views[iview].data;
+}
+
+size_t TreeInput::get_view_branch(size_t iview) const
+{
+  return detail_->views[iview].ibranch;
+}
+
+const void *TreeInput::load_view(size_t iview) const
+{
+  const Detail::View &view = detail_->views[iview];
+  if(!get_branch_data(view.ibranch)) return nullptr;
+  return view.data;
+}
+
+size_t TreeInput::select_shard(size_t ishard, size_t nshard)
+{
+  vector<string> &filenames = detail_->filenames;
+  if(ishard >= nshard) { filenames.clear(); return 0; }
+  vector<pair<size_t, size_t>> sizes;  // (size, index)
+  for(size_t i = 0; i < filenames.size(); ++i) sizes.emplace_back(Stat(filenames[i].c_str()).size(), i);
+  sort(sizes.begin(), sizes.end(), [&filenames](const pair<size_t, size_t> &a, const pair<size_t, size_t> &b) {
+    if(a.first != b.first) return a.first > b.first;
+    return filenames[a.second] < filenames[b.second];
+  });
+
+  // Longest processing time first.
+  vector<size_t> loads(nshard);
+  vector<bool> selected(filenames.size());
+  size_t selected_size = 0;
+  for(const auto &size_index : sizes) {
+    size_t j = min_element(loads.begin(), loads.end()) - loads.begin();
+    loads[j] += size_index.first;
+    if(j == ishard) selected[size_index.second] = true, selected_size += size_index.first;
+  }
+
+  vector<string> kept;
+  for(size_t i = 0; i < filenames.size(); ++i) if(selected[i]) kept.push_back(std::move(filenames[i]));
+  clog << "Info: shard " << ishard << "/" << nshard << ": " << kept.size() << " of "
+       << filenames.size() << " files, " << selected_size << " bytes" << endl;
+  filenames = std::move(kept);
+  return filenames.size();
+}
+
+size_t TreeInput::scan_files(size_t nthread)
+{
+  if(nthread == 0) nthread = thread::hardware_concurrency();
+  if(nthread == 0) nthread = 1;
+  if(nthread > 1) ROOT::EnableThreadSafety();
+  size_t nfilename = get_nfilename();
+  detail_->reset_scan();
+
+  atomic<size_t> cursor(0);
+  auto scan = [this, &cursor, nfilename]() {
+    for(size_t i; (i = cursor++) < nfilename;) detail_->scan_file(i, name_);
+  };
+  vector<thread> threads;
+  for(size_t i = 1; i < min(nthread, nfilename); ++i) threads.emplace_back(scan);
+  scan();
+  for(thread &t : threads) t.join();
+
+  for(size_t i = 0; i < nfilename; ++i) {
+    if(!detail_->file_problems[i].empty()) cerr << "Warning: " << detail_->file_problems[i] << ": " << get_filename(i) << endl;
+  }
+  size_t nentry = 0, zip_bytes = 0;
+  for(size_t i = 0; i < nfilename; ++i) nentry += detail_->file_nentry[i], zip_bytes += detail_->file_zip_bytes[i];
+  clog << "Info: scanned " << nfilename << " files: " << nentry << " entries, "
+       << zip_bytes << " compressed bytes" << endl;
+  detail_->set_progress_totals();
+  return nentry;
+}
+
+size_t TreeInput::plan_files(size_t nthread, const char *cache_path)
+{
+  // Problems depend on the types views convert to, besides the inputs.
+  Hasher hasher;
+  hash_inputs(hasher);
+  for(const Detail::View &view : detail_->views) hasher.update((uint64_t)view.ibranch).update((uint64_t)view.type);
+  string key = hasher.hexdigest();
+  detail_->reset_scan();
+  if(cache_path && detail_->load_plan(cache_path, key)) {
+    clog << "Info: loaded plan of " << get_nfilename() << " files: " << cache_path << endl;
+    for(size_t i = 0; i < get_nfilename(); ++i) {
+      if(!detail_->file_problems[i].empty()) cerr << "Warning: " << detail_->file_problems[i] << ": " << get_filename(i) << endl;
+    }
+    detail_->set_progress_totals();
+  } else {
+    scan_files(nthread);
+    if(cache_path && !detail_->save_plan(cache_path, key)) cerr << "Warning: failed to save plan: " << cache_path << endl;
+  }
+  return detail_->apply_plan();
+}
+
+void TreeInput::share_plan(const TreeInput &other)
+{
+  if(!other.detail_->planned || other.get_nfilename() != get_nfilename()) return;
+  detail_->file_nentry = other.detail_->file_nentry;
+  detail_->file_zip_bytes = other.detail_->file_zip_bytes;
+  detail_->file_clusters = other.detail_->file_clusters;
+  detail_->file_problems = other.detail_->file_problems;
+  detail_->file_branch_bytes = other.detail_->file_branch_bytes;
+  detail_->file_branch_nelem = other.detail_->file_branch_nelem;
+  detail_->apply_plan();
+}
+
+bool TreeInput::is_planned() const
+{
+  return detail_->planned;
+}
+
+const char *TreeInput::get_file_problem(size_t i) const
+{
+  if(!detail_->planned || i >= detail_->file_problems.size() || detail_->file_problems[i].empty()) return nullptr;
+  return detail_->file_problems[i].c_str();
+}
+
+bool TreeInput::is_scanned() const
+{
+  return !detail_->file_nentry.empty() && detail_->file_nentry.size() == get_nfilename();
+}
+
+size_t TreeInput::get_file_nentry(size_t i) const
+{
+  return i < detail_->file_nentry.size() ? detail_->file_nentry[i] : 0;
+}
+
+size_t TreeInput::get_file_zip_bytes(size_t i) const
+{
+  return i < detail_->file_zip_bytes.size() ? detail_->file_zip_bytes[i] : 0;
+}
+
+vector<size_t> TreeInput::get_file_clusters(size_t i) const
+{
+  return i < detail_->file_clusters.size() ? detail_->file_clusters[i] : vector<size_t>();
+}
+
+void TreeInput::set_progress_interval(double seconds)
+{
+  if(seconds <= 0.0) { detail_->progress.reset(); return; }
+  detail_->progress = make_shared<Detail::Progress>();
+  Detail::Progress &p = *detail_->progress;
+  p.start = chrono::steady_clock::now();
+  p.interval = seconds * 1e9;
+  p.nevent = p.nbyte = p.nfile_started = 0;
+  p.last_report = 0;
+  detail_->set_progress_totals();
+}
+
+void TreeInput::share_progress(const TreeInput &other)
+{
+  detail_->progress = other.detail_->progress;
+}
+
+void TreeInput::set_cache_enabled(bool enable)
+{
+  detail_->cache_enabled = enable;
+}
+
+bool TreeInput::get_cache_enabled() const
+{
+  return detail_->cache_enabled;
+}
+
+void TreeInput::set_cache_size(size_t size)
+{
+  detail_->cache_size = size;
+}
+
+size_t TreeInput::get_cache_size() const
+{
+  return detail_->cache_size;
+}
+
+void TreeInput::set_cache_learn_entries(size_t n)
+{
+  detail_->cache_learn_entries = n;
+}
+
+size_t TreeInput::get_cache_learn_entries() const
+{
+  return detail_->cache_learn_entries;
+}
+
+TreeInput::IOStats TreeInput::get_io_stats() const
+{
+  IOStats stats = detail_->io_stats;
+  Detail::add_io_stats(stats, detail_->get_file_io_stats());
+  return stats;
+}
+
+void TreeInput::set_prefetch(size_t nfile)
+{
+  if(nfile) ROOT::EnableThreadSafety();
+  detail_->prefetch_depth = nfile;
+}
+
+size_t TreeInput::get_prefetch() const
+{
+  return detail_->prefetch_depth;
+}
+
+void TreeInput::set_dispatcher(function<size_t()> dispatcher)
+{
+  detail_->dispatcher = std::move(dispatcher);
+}
+
+void TreeInput::set_task_dispatcher(function<Task()> dispatcher)
+{
+  detail_->task_dispatcher = std::move(dispatcher);
+}
+
+void TreeInput::set_entry_range(size_t begin, size_t end)
+{
+  detail_->range_begin = begin;
+  detail_->range_end = end;
+}
+
+size_t TreeInput::get_entry_begin() const
+{
+  return detail_->entry_begin;
+}
+
+size_t TreeInput::get_entry_end() const
+{
+  return detail_->entry_end;
+}
+
+void TreeInput::merge(const TreeInput &other)
+{
+  Detail::add_io_stats(detail_->io_stats, other.detail_->io_stats);
+
+  // Only finished inputs have a valid total.
+  if(other.detail_->ifilename != other.get_nfilename()) return;
+  if(detail_->ifilename != get_nfilename()) return;
+  detail_->global_index += other.detail_->global_index;
+}
+
+const void *TreeInput::get_branch_data(size_t i, size_t *nelem) const
 {
   if(i >= detail_->branch_data.size()) return nullptr;
+  if(detail_->branch_lazy[i] && !detail_->load_branch(i)) return nullptr;
   if(nelem) *nelem = detail_->branch_current_size[i] / detail_->branch_elem_size[i];
-  return detail_->branch_data[i].get();
+  return detail_->get_data(i);
 }
 
-static size_t get_branch_elem_size_impl(TBranch *branch)
+void TreeInput::hash_inputs(Hasher &hasher) const
 {
-  TClass *c; EDataType e;
-  if(branch->GetExpectedType(c, e)) return 0;
-  if(c) return sizeof(void *);  // Class objects are referenced by pointers.
-  return TDataType::GetDataType(e)->Size();
+  hasher.update(name_);
+  hasher.update((uint64_t)get_nfilename());
+  for(const string &filename : detail_->filenames) {
+    Stat st(filename.c_str());
+    hasher.update(filename).update((uint64_t)st.size()).update((uint64_t)st.mtime());
+  }
+  hasher.update((uint64_t)get_nbranch());
+  for(const string &branch_name : detail_->branch_names) hasher.update(branch_name);
 }
 
-size_t TreeInput::get_branch_elem_size(size_t i) const
+size_t TreeInput::next_batch(size_t n)
 {
-  if(i >= detail_->branch_elem_size.size()) return 0;
-  return detail_->branch_elem_size[i];
+  Detail &d = *detail_;
+  d.batch_size = 0;
+  d.batch_data.resize(get_nbranch());
+  d.batch_offsets.resize(get_nbranch());
+  for(size_t i = 0; i < get_nbranch(); ++i) {
+    d.batch_data[i].clear();
+    d.batch_offsets[i].assign(1, 0);
+  }
+  if(n == 0) return 0;
+
+  // Files are only switched at the beginning of a batch.
+  if(!next()) return 0;
+  d.append_batch();
+  while(d.batch_size < n && d.GetEntry(d.local_index + 1) > 0) {
+    ++d.local_index;
+    ++d.global_index;
+    d.append_batch();
+  }
+  if(d.progress) d.publish_progress(d.local_index + 1 - d.entry_begin);
+  return d.batch_size;
 }
 
-static size_t get_branch_nelem_max_impl(TBranch *branch)
+size_t TreeInput::get_batch_size() const
 {
-  TObjArray *leaves = branch->GetListOfLeaves();
-  if(leaves->GetEntries() != 1) return 0;  // [XXX] not implemented
-  TLeaf *leaf = (TLeaf *)leaves->UncheckedAt(0);
-  Int_t count = 0;
-  TLeaf *leafcnt = leaf->GetLeafCounter(count);
-  if(leafcnt) count = leafcnt->GetMaximum();
-  return max(count, (Int_t)0);
+  return detail_->batch_size;
+}
+
+void *TreeInput::get_batch_data(size_t i, const size_t **offsets) const
+{
+  if(i >= detail_->batch_data.size()) return nullptr;
+  if(offsets) *offsets = detail_->batch_offsets[i].data();
+  return detail_->batch_data[i].data();
+}
+
+char TreeInput::get_branch_type(size_t i) const
+{
+  if(i >= detail_->branch_type.size()) return 0;
+  return detail_->branch_type[i];
+}
+
+size_t TreeInput::get_branch_elem_size(size_t i) const
+{
+  if(i >= detail_->branch_elem_size.size()) return 0;
+  return detail_->branch_elem_size[i];
 }
 
 size_t TreeInput::get_branch_nelem_max(size_t i) const
@@ -167,23 +1235,89 @@ size_t TreeInput::get_branch_nelem_max(size_t i) const
   return detail_->branch_nelem_max[i];
 }
 
+const void *TreeInput::get_branch_span(size_t i, size_t *nelem) const
+{
+  const void *data = get_branch_data(i, nelem);
+  if(!data || !detail_->branch_proxy[i]) return data;
+
+  // The buffer holds a pointer to the vector object ROOT reads into, whose
+  // storage is reused across entries.
+  TVirtualCollectionProxy *proxy = detail_->branch_proxy[i].get();
+  void *object = *(void *const *)data;
+  if(!object) return nullptr;
+  proxy->PushProxy(object);
+  size_t size = proxy->Size();
+  const void *elems = size ? proxy->At(0) : object;
+  proxy->PopProxy();
+  if(nelem) *nelem = size;
+  return elems;
+}
+
+char TreeInput::get_branch_span_type(size_t i) const
+{
+  if(i >= detail_->branch_span_type.size()) return 0;
+  return detail_->branch_span_type[i];
+}
+
+size_t TreeInput::get_branch_nleaf(size_t i) const
+{
+  if(i >= detail_->branch_leaves.size()) return 0;
+  return detail_->branch_leaves[i].size();
+}
+
+const char *TreeInput::get_branch_leaf(size_t i, size_t j) const
+{
+  if(j >= get_branch_nleaf(i)) return nullptr;
+  return detail_->branch_leaves[i][j].name.c_str();
+}
+
+char TreeInput::get_branch_leaf_type(size_t i, size_t j) const
+{
+  if(j >= get_branch_nleaf(i)) return 0;
+  return detail_->branch_leaves[i][j].type;
+}
+
+size_t TreeInput::get_branch_leaf_offset(size_t i, size_t j) const
+{
+  if(j >= get_branch_nleaf(i)) return 0;
+  return detail_->branch_leaves[i][j].offset;
+}
+
 bool TreeInput::next()
 {
-  if(detail_->tree) {
+  if(detail_->tree || detail_->skim) {
     // The most frequent case: step forward within current file.
     if(detail_->GetEntry(detail_->local_index + 1) > 0) {
       ++detail_->local_index;
       ++detail_->global_index;
+      if(detail_->progress && (detail_->local_index & 0xfff) == 0xfff) {
+        detail_->publish_progress(detail_->local_index + 1 - detail_->entry_begin);
+      }
       return true;
     }
 
     // Reading failed. Close current file.
-    size_t nread = ++detail_->local_index;
-    size_t total = detail_->tree->GetEntries();
-    clog << "Info: closing file: [" << nread << "/" << total << "] " << get_filename() << endl;
+    // The local index is left one past the last entry read, for on_close_file().
+    size_t nread = ++detail_->local_index - detail_->entry_begin;
+    size_t total = detail_->skim ? detail_->skim->nevent : detail_->tree->GetEntries();
+    clog << "Info: closing file: [" << nread << "/" << total << "] ";
+    if(detail_->entry_begin || detail_->entry_end < total) {
+      clog << "entries " << detail_->entry_begin << "-" << detail_->entry_end << " of ";
+    }
+    clog << get_filename() << endl;
+    if(get_profiling()) {
+      IOStats stats = detail_->get_file_io_stats();
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - detail_->file_start).count();
+      clog << "Info: read " << stats.bytes_read << " bytes in " << stats.read_calls << " calls and "
+           << seconds << " s from file: " << get_filename() << endl;
+    }
     on_close_file();
+    if(detail_->progress) detail_->publish_progress(nread);
+    detail_->progress_nevent = detail_->progress_nbyte = 0;
+    Detail::add_io_stats(detail_->io_stats, detail_->get_file_io_stats());
     detail_->tree = nullptr;
     detail_->file.reset();
+    detail_->skim.reset();
     detail_->local_index = -1;
   }
 
@@ -192,32 +1326,66 @@ bool TreeInput::next()
 
   // No file opened. Try to open the next file to read.
   for(;;) {
-    const char *filename = get_filename(++detail_->ifilename);
+    future<Detail::OpenedFile> prefetched;
+    Task task;
+    if(detail_->prefetches.empty()) {
+      task = detail_->claim_task(get_nfilename());
+    } else {
+      task = detail_->prefetches.front().first;
+      prefetched = std::move(detail_->prefetches.front().second);
+      detail_->prefetches.pop_front();
+    }
+    detail_->ifilename = task.ifilename;
+    detail_->entry_begin = task.begin;
+    detail_->entry_end = task.end;
+    detail_->fill_prefetches(name_);
+    const char *filename = get_filename(detail_->ifilename);
     if(filename == nullptr) break;
+    if(detail_->progress && task.begin == 0) ++detail_->progress->nfile_started;
     if(!on_new_file(filename)) {
       clog << "Info: skipping file: " << get_filename() << endl;
+      detail_->drop_progress(task);
       continue;
     }
     clog << "Info: opening file: " << get_filename() << endl;
 
-    unique_ptr<TFile> file(new TFile(filename));
+    if(Detail::is_skim(filename)) {
+      string error = detail_->open_skim(filename);
+      if(!error.empty()) {
+        cerr << "Warning: skipping skim file with " << error << ": " << filename << endl;
+        detail_->drop_progress(task);
+        continue;
+      }
+      detail_->entry_end = min(detail_->entry_end, detail_->skim->nevent);
+      detail_->local_index = detail_->entry_begin - 1;
+      detail_->file_start = chrono::steady_clock::now();
+      on_open_file();
+      return next();
+    }
+
+    Detail::OpenedFile opened = prefetched.valid() ? prefetched.get() : Detail::open_file(filename, name_, { });
+    unique_ptr<TFile> file = std::move(opened.file);
     if(!file->IsOpen()) {
       cerr << "Warning: skipping broken file: " << filename << endl;
+      detail_->drop_progress(task);
       continue;
     }
 
-    auto tree = dynamic_cast<TTree *>(file->Get(name_));
+    auto tree = opened.tree;
     if(!tree) {
       cerr << "Warning: skipping empty file: " << filename << endl;
+      detail_->drop_progress(task);
       continue;
     }
 
-    vector<unique_ptr<void, function<void(void *)>>> &branch_data = detail_->branch_data;
-    vector<size_t> &branch_data_capacity = detail_->branch_data_capacity;
     vector<TBranch *> branches;
     vector<size_t> branch_current_size;
     vector<size_t> branch_elem_size;
     vector<size_t> branch_nelem_max;
+    vector<char> branch_type;
+    vector<vector<BranchLeaf>> branch_leaves;
+    vector<unique_ptr<TVirtualCollectionProxy>> branch_proxy;
+    vector<char> branch_span_type;
 
     for(const string &name : detail_->branch_names) {
       TBranch *branch = tree->GetBranch(name.c_str());
@@ -225,31 +1393,34 @@ bool TreeInput::next()
         cerr << "Warning: skipping file missing branch " << name << ": " << filename << endl;
         goto CONTINUE;
       }
-      size_t elem_size = get_branch_elem_size_impl(branch);
-      size_t nelem_max = get_branch_nelem_max_impl(branch);
+      BranchLayout layout = get_branch_layout(branch);
+      size_t elem_size = layout.elem_size;
+      size_t nelem_max = layout.nelem_max;
       if(elem_size == 0 || nelem_max == 0) {
         cerr << "Warning: skipping file with unsupported branch " << name << ": " << filename << endl;
         goto CONTINUE;
       }
-      size_t max_size = elem_size * nelem_max;
       size_t i = branches.size();
-      if(branch_data.size() == i) {
-        branch_data.emplace_back(nullptr, [](void *p) { free(p); });
-        branch_data_capacity.emplace_back(0);
-      }
-      void *buf = branch_data[i].get();
-      if(expand_buffer_init(buf, branch_data_capacity[i], max_size, sizeof(void *))) {
-        branch_data[i].release();
-        branch_data[i].reset(buf);
-      } else {
+      if(!detail_->bind_buffer(i, elem_size * nelem_max)) {
         cerr << "Warning: skipping file with branch " << name << " unallocable: " << filename << endl;
         goto CONTINUE;
       }
-      branch->SetAddress(buf);
+      branch->SetAddress(detail_->branch_data[i].get());
       branches.emplace_back(branch);
       branch_current_size.push_back(0);
       branch_elem_size.push_back(elem_size);
       branch_nelem_max.push_back(nelem_max);
+      branch_type.push_back(layout.type);
+      branch_leaves.push_back(std::move(layout.leaves));
+      branch_proxy.emplace_back(layout.proxy ? layout.proxy->Generate() : nullptr);
+      branch_span_type.push_back(layout.span_type);
+    }
+    {
+      string error = detail_->bind_views(branch_type, branch_nelem_max);
+      if(!error.empty()) {
+        cerr << "Warning: skipping file with " << error << ": " << filename << endl;
+        goto CONTINUE;
+      }
     }
 
     detail_->file = std::move(file);
@@ -258,20 +1429,37 @@ bool TreeInput::next()
     detail_->branch_current_size = std::move(branch_current_size);
     detail_->branch_elem_size = std::move(branch_elem_size);
     detail_->branch_nelem_max = std::move(branch_nelem_max);
+    detail_->branch_type = std::move(branch_type);
+    detail_->branch_leaves = std::move(branch_leaves);
+    detail_->branch_proxy = std::move(branch_proxy);
+    detail_->branch_span_type = std::move(branch_span_type);
+    detail_->branch_entry.assign(detail_->branches.size(), -1);
+    detail_->entry_end = min(detail_->entry_end, (size_t)detail_->tree->GetEntries());
+    detail_->local_index = detail_->entry_begin - 1;
+    detail_->setup_cache();
+    detail_->file_start = chrono::steady_clock::now();
     on_open_file();
     return next();
 
-    CONTINUE: continue;
+    CONTINUE:
+    detail_->drop_progress(task);
   }
 
   // Reach the end.
   ++detail_->global_index;
   clog << "Info: total events read: " << detail_->global_index << endl;
+  const IOStats &stats = detail_->io_stats;
+  clog << "Info: total bytes read: " << stats.bytes_read << " in " << stats.read_calls << " calls ("
+       << stats.cache_hit_calls << " cache hits, " << stats.cache_miss_calls << " misses)" << endl;
   detail_->branches.clear();
   detail_->branch_data.clear();
   detail_->branch_data_capacity.clear();
   detail_->branch_current_size.clear();
   detail_->branch_elem_size.clear();
   detail_->branch_nelem_max.clear();
+  detail_->branch_type.clear();
+  detail_->branch_leaves.clear();
+  detail_->branch_proxy.clear();
+  detail_->branch_span_type.clear();
   return false;
 }
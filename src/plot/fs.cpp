@@ -162,6 +162,11 @@ size_t Stat::size() const
   return sbuf ? sbuf->st_size : 0;
 }
 
+long long Stat::mtime() const
+{
+  return sbuf ? sbuf->st_mtim.tv_sec * 1000000000LL + sbuf->st_mtim.tv_nsec : 0;
+}
+
 string basename(const string &path)
 {
   size_t pos = path.rfind("/");